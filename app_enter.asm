@@ -0,0 +1,81 @@
+; app_enter for 16-bit NASM
+; Function signature:
+; unsigned short app_enter(unsigned short seg, unsigned short entry,
+;                          unsigned short sp, unsigned short near_ret)
+;
+; Runs an app that lives in its own segment. SS, DS and ES are set to `seg`,
+; SP to `sp`, and seg:entry is far-called. If `near_ret` is non-zero, it is
+; pushed as a near return address on top of the far one, so an app that ends
+; with a near RET lands on a RETF stub at seg:near_ret. The kernel stack is
+; restored on return.
+;
+; Returns: AX as left by the app
+
+BITS 16
+
+section .bss
+saved_ss resw 1
+saved_sp resw 1
+
+section .text
+global app_enter
+
+app_enter:
+    push bp
+    mov  bp, sp
+    push bx
+    push cx
+    push dx
+    push si
+    push di
+    push ds
+    push es
+
+    ; Stack layout (16-bit):
+    ; [bp+0]  = old BP
+    ; [bp+2]  = return address
+    ; [bp+4]  = app segment (word)
+    ; [bp+6]  = entry offset (word)
+    ; [bp+8]  = initial SP (word)
+    ; [bp+10] = near return stub offset, 0 for none (word)
+
+    mov  ax, [bp+4]
+    mov  bx, [bp+6]
+    mov  cx, [bp+8]
+    mov  dx, [bp+10]
+
+    mov  [saved_ss], ss ; DS is still the kernel segment here
+    mov  [saved_sp], sp
+
+    cli
+    mov  ss, ax
+    mov  sp, cx
+    sti
+    mov  ds, ax
+    mov  es, ax
+
+    push cs             ; Far return into the kernel
+    push word .back
+    test dx, dx
+    jz   .enter
+    push dx             ; Near return onto the RETF stub
+.enter:
+    push ax             ; Far jump to seg:entry
+    push bx
+    retf
+
+.back:
+    cli
+    mov  ss, [cs:saved_ss]
+    mov  sp, [cs:saved_sp]
+    sti
+
+    pop  es
+    pop  ds
+    pop  di
+    pop  si
+    pop  dx
+    pop  cx
+    pop  bx
+    pop  bp
+    ret
@@ -1,21 +1,86 @@
-; bios_read_sector for 16-bit NASM
-; Function signature:
+; bios_read_sector / bios_read_sectors / bios_write_sectors for 16-bit NASM
+; Function signatures:
 ; unsigned char bios_read_sector(unsigned char drive, unsigned char head,
 ;                                 unsigned char track, unsigned char sector, void* buffer)
+; unsigned char bios_read_sectors(unsigned char drive, unsigned char head,
+;                                  unsigned short track, unsigned char sector,
+;                                  unsigned char count, farptr_t buffer)
+; unsigned char bios_write_sectors(unsigned char drive, unsigned char head,
+;                                   unsigned short track, unsigned char sector,
+;                                   unsigned char count, farptr_t buffer)
+;
+; bios_read_sectors reads `count` sectors starting at the given CHS address
+; into a far buffer. All sectors must lie on the same track; the caller splits
+; requests at track boundaries. Cylinders above 255 are encoded in bits 6-7
+; of CL as INT 13h expects. Requests that would cross a 64 KB physical
+; (DMA) boundary are split here, and a sector that straddles the boundary is
+; read through a bounce buffer. bios_write_sectors is the same transfer
+; with INT 13h AH=03h; a straddling sector is copied into the bounce buffer
+; and written from there.
 ;
 ; Returns: 0 = success, 1 = error
+;
+; bios_disk_calls and bios_disk_retries count INT 13h requests and
+; failed attempts that were retried (dwords, read by the kernel's stats).
 
 BITS 16
 
+section .bss
+bounce_buffer resb 512
+disk_op       resb 1        ; INT 13h function: 02h read, 03h write
+bios_disk_calls   resd 1
+bios_disk_retries resd 1
+
 section .text
 global bios_read_sector
+global bios_read_sectors
+global bios_write_sectors
+global bios_disk_calls
+global bios_disk_retries
 
 bios_read_sector:
     push bp
     mov  bp, sp
+
+    ; Stack layout (16-bit):
+    ; [bp+0]  = old BP
+    ; [bp+2]  = return address
+    ; [bp+4]  = drive (byte)
+    ; [bp+6]  = head (byte)
+    ; [bp+8]  = track/cylinder (byte)
+    ; [bp+10] = sector (byte)
+    ; [bp+12] = buffer pointer (word)
+
+    ; Forward to bios_read_sectors with count = 1 and buffer = DS:buffer
+    push ds
+    push word [bp+12]
+    push word 1
+    push word [bp+10]
+    mov  al, [bp+8]     ; Widen the byte cylinder to a word
+    xor  ah, ah
+    push ax
+    push word [bp+6]
+    push word [bp+4]
+    call bios_read_sectors
+    add  sp, 14
+
+    pop  bp
+    ret
+
+bios_write_sectors:
+    mov  byte [disk_op], 0x03
+    jmp  bios_transfer
+
+bios_read_sectors:
+    mov  byte [disk_op], 0x02
+
+bios_transfer:
+    push bp
+    mov  bp, sp
     push bx
     push cx
     push dx
+    push si
     push di
     push es
 
@@ -24,47 +89,157 @@ bios_read_sector:
     ; [bp+2]  = return address
     ; [bp+4]  = drive (byte)
     ; [bp+6]  = head (byte)
-    ; [bp+8]  = track/cylinder (byte)
-    ; [bp+10] = sector (byte)
-    ; [bp+12] = buffer pointer (word)
+    ; [bp+8]  = track/cylinder (word)
+    ; [bp+10] = first sector (byte, 1-based)
+    ; [bp+12] = sector count (byte)
+    ; [bp+14] = buffer offset (word)
+    ; [bp+16] = buffer segment (word)
 
-    ; Get drive number
-    mov  dl, [bp+4]     ; DL = drive (0x00 for floppy A:)
+    ; Normalize the far pointer so that BX < 16 and ES carries the rest.
+    ; Advancing by whole sectors is then a pure segment add.
+    mov  bx, [bp+14]
+    mov  ax, bx
+    shr  ax, 4
+    add  ax, [bp+16]
+    mov  es, ax
+    and  bx, 0x000F
 
-    ; Get head number
-    mov  dh, [bp+6]     ; DH = head
+    mov  cl, [bp+10]    ; CL = current sector
+    mov  si, [bp+12]
+    and  si, 0x00FF     ; SI = sectors remaining
+
+.next_chunk:
+    test si, si
+    jz   .success
+
+    ; Sectors that fit before the next 64 KB physical boundary
+    mov  ax, es
+    shl  ax, 4
+    add  ax, bx         ; AX = low 16 bits of physical address
+    neg  ax             ; AX = bytes up to boundary (0 means a full 64 KB)
+    jz   .whole_window
+    shr  ax, 9          ; AX = whole sectors up to boundary
+    jz   .bounce        ; Next sector straddles the boundary
+    jmp  .clamp
+.whole_window:
+    mov  ax, 128
+.clamp:
+    cmp  ax, si
+    jbe  .have_count
+    mov  ax, si
+.have_count:
+    mov  di, ax         ; DI = sectors in this chunk
 
-    ; Get cylinder (track)
-    mov  ch, [bp+8]     ; CH = cylinder
+    call .transfer      ; DI sectors at CL to or from ES:BX
+    jc   .error
 
-    ; Get sector number
-    mov  cl, [bp+10]    ; CL = sector (1-based)
+    ; Advance: sector += n, ES += n * 32 paragraphs
+    mov  ax, di
+    add  cl, al
+    sub  si, ax
+    shl  ax, 5
+    mov  dx, es
+    add  dx, ax
+    mov  es, dx
+    jmp  .next_chunk
 
-    ; Get buffer address
-    mov  bx, [bp+12]    ; BX = buffer offset
+.bounce:
+    ; Transfer one sector through the bounce buffer, which never crosses a
+    ; boundary (it lives in the kernel segment): copied in before a write,
+    ; copied out after a read.
+    cmp  byte [disk_op], 0x03
+    jne  .bounce_io
 
-    ; Set ES to current DS (assume same segment)
+    push cx
+    push si
     push ds
+    push es
+    mov  ax, ds
+    push es
+    pop  ds             ; DS:SI = caller's sector
+    mov  es, ax         ; ES:DI = bounce buffer
+    mov  si, bx
+    mov  di, bounce_buffer
+    mov  cx, 256
+    cld
+    rep  movsw
     pop  es
+    pop  ds
+    pop  si
+    pop  cx
 
-    ; Set up BIOS read parameters
-    ; AH = 0x02 (read sectors)
-    ; AL = 0x01 (number of sectors to read)
-    ; CH = cylinder/track
-    ; CL = sector
-    ; DH = head
-    ; DL = drive
-    ; ES:BX = buffer address
+.bounce_io:
+    push es
+    push bx
+    push ds
+    pop  es
+    mov  bx, bounce_buffer
+    mov  di, 1
+    call .transfer
+    pop  bx
+    pop  es
+    jc   .error
+
+    cmp  byte [disk_op], 0x03
+    je   .bounce_next
+
+    push cx
+    push si
+    mov  di, bx
+    mov  si, bounce_buffer
+    mov  cx, 256
+    cld
+    rep  movsw
+    pop  si
+    pop  cx
 
-    mov  ah, 0x02       ; BIOS function: read sectors
-    mov  al, 0x01       ; Read 1 sector
+.bounce_next:
+    inc  cl
+    dec  si
+    mov  ax, es
+    add  ax, 32
+    mov  es, ax
+    jmp  .next_chunk
 
-    ; Retry up to 3 times
-    mov  di, 3
+.success:
+    xor  al, al         ; Return 0 (success)
+    jmp  .done
+
+.error:
+    mov  al, 1          ; Return error code
+
+.done:
+    pop  es
+    pop  di
+    pop  si
+    pop  dx
+    pop  cx
+    pop  bx
+    pop  bp
+    ret
+
+; Read or write (per disk_op) DI sectors starting at sector CL at ES:BX,
+; retrying up to 3 times with a disk reset between attempts. Uses the
+; caller's BP frame for the drive, head and track. Returns with CF set on
+; failure.
+.transfer:
+    push dx
+    push si
+    mov  dl, [bp+4]     ; DL = drive (0x00 for floppy A:)
+    mov  dh, [bp+6]     ; DH = head
+    mov  si, 3          ; Retry up to 3 times
 .retry:
     pusha               ; Save all registers
+    mov  ax, [bp+8]
+    mov  ch, al         ; CH = cylinder bits 0-7
+    shl  ah, 6
+    or   cl, ah         ; CL bits 6-7 = cylinder bits 8-9
+    add  word [bios_disk_calls], 1
+    adc  word [bios_disk_calls+2], 0
+    mov  ax, di
+    mov  ah, [disk_op]  ; BIOS function: read or write sectors, AL = count
     int  0x13           ; Call BIOS disk interrupt
-    jnc  .success       ; If carry clear, read succeeded
+    jnc  .transfer_ok   ; If carry clear, the transfer succeeded
 
     ; Reset disk system on error
     popa                ; Restore registers
@@ -73,22 +248,20 @@ bios_read_sector:
     int  0x13
     popa                ; Restore registers
 
-    dec  di
-    jnz  .retry         ; Retry if attempts remaining
-
-    ; All retries failed
-    mov  al, 1          ; Return error code
-    jmp  .done
+    dec  si
+    jz   .failed
+    add  word [bios_disk_retries], 1
+    adc  word [bios_disk_retries+2], 0
+    jmp  .retry         ; Retry if attempts remaining
+.failed:                ; All retries failed
+    pop  si
+    pop  dx
+    stc
+    ret
 
-.success:
+.transfer_ok:
     popa                ; Clean up saved registers
-    xor  al, al         ; Return 0 (success)
-
-.done:
-    pop  es
-    pop  di
+    pop  si
     pop  dx
-    pop  cx
-    pop  bx
-    pop  bp
+    clc
     ret
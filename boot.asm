@@ -2,9 +2,43 @@
 %define KERNEL_SECTORS 20
 %endif
 
+%if KERNEL_SECTORS > 128
+%error "kernel does not fit in its 64 KB segment"
+%endif
+
+KERNEL_SEG  equ 0x1000
+BOOT_INFO   equ 0x0600          ; Read by the kernel, see boot_info in kernel.c
+BOOT_MAGIC  equ 0x5442          ; "BT"
+BDA_TICKS   equ 0x046C
+
 BITS 16
 ORG 0x7C00
 
+    jmp short start
+    nop
+
+; BIOS parameter block for a 1.44 MB floppy. The kernel sits in the
+; reserved sectors right after this one, so the FAT area never overlaps it.
+bpb_oem             db "BUBBLES "
+bpb_bytes_per_sec   dw 512
+bpb_sec_per_cluster db 1
+bpb_reserved        dw 1 + KERNEL_SECTORS
+bpb_num_fats        db 2
+bpb_root_entries    dw 224
+bpb_total_sectors   dw 2880
+bpb_media           db 0xF0
+bpb_sec_per_fat     dw 9
+bpb_sec_per_track   dw 18
+bpb_num_heads       dw 2
+bpb_hidden          dd 0
+bpb_total_long      dd 0
+bpb_drive           db 0
+bpb_reserved1       db 0
+bpb_boot_sig        db 0x29
+bpb_serial          dd 0x20250926
+bpb_label           db "BUBBLES    "
+bpb_fs_type         db "FAT12   "
+
 start:
     cli
     xor ax, ax
@@ -14,20 +48,92 @@ start:
     mov sp, 0x7C00
     sti
     mov [BootDrive], dl
+
+    mov word [BOOT_INFO], BOOT_MAGIC
+    mov ax, [BDA_TICKS]
+    mov [BOOT_INFO+2], ax
+    mov ax, [BDA_TICKS+2]
+    mov [BOOT_INFO+4], ax
+    mov word [BOOT_INFO+10], KERNEL_SECTORS
+
     mov si, msg_boot
     call puts
-    mov ax, 0x1000
+
+    ; Load the kernel a track (or less) per call. The buffer offset stays
+    ; 0 and ES advances by 32 paragraphs per sector.
+    mov ax, KERNEL_SEG
     mov es, ax
-    xor bx, bx
+
+.next_read:
+    ; LBA -> CHS
+    mov ax, [Lba]
+    xor dx, dx
+    div word [bpb_sec_per_track]    ; AX = track, DX = sector - 1
+    mov cl, dl
+    inc cl                          ; CL = sector (1-based)
+    mov si, [bpb_sec_per_track]
+    sub si, dx                      ; SI = sectors left on this track
+    xor dx, dx
+    div word [bpb_num_heads]        ; AX = cylinder, DX = head
+    mov ch, al                      ; CH = cylinder bits 0-7
+    shl ah, 6
+    or  cl, ah                      ; CL bits 6-7 = cylinder bits 8-9
+    mov dh, dl                      ; DH = head
+
+    cmp si, [Left]
+    jbe .fits_load
+    mov si, [Left]
+.fits_load:
+
+    ; Stop at the next 64 KB physical (DMA) boundary
+    mov ax, es
+    shl ax, 4
+    neg ax                          ; Bytes to boundary, 0 means a full 64 KB
+    jz  .fits_dma
+    shr ax, 9
+    cmp si, ax
+    jbe .fits_dma
+    mov si, ax
+.fits_dma:
+
+    mov di, 3                       ; Retry up to 3 times
+.retry:
     mov dl, [BootDrive]
-    mov ah, 0x02
-    mov al, KERNEL_SECTORS
-    mov ch, 0x00
-    mov dh, 0x00
-    mov cl, 0x02
+    xor bx, bx
+    mov ax, si
+    mov ah, 0x02                    ; Read sectors, AL = count
+    int 0x13
+    jnc .read_ok
+    xor ah, ah                      ; Reset disk system and try again
     int 0x13
-    jc disk_error
-    jmp 0x1000:0x0000
+    dec di
+    jnz .retry
+    jmp disk_error
+
+.read_ok:
+    mov ax, 0x0E2E                  ; Progress dot
+    xor bx, bx
+    int 0x10
+
+    mov ax, si
+    add [Lba], ax
+    sub [Left], ax
+    shl ax, 5
+    mov dx, es
+    add dx, ax
+    mov es, dx
+    cmp word [Left], 0
+    jne .next_read
+
+    mov ax, [BDA_TICKS]
+    mov [BOOT_INFO+6], ax
+    mov ax, [BDA_TICKS+2]
+    mov [BOOT_INFO+8], ax
+
+    mov si, msg_crlf
+    call puts
+    mov dl, [BootDrive]
+    jmp KERNEL_SEG:0x0000
 
 disk_error:
     mov si, msg_err
@@ -47,8 +153,11 @@ puts:
     popa
     ret
 
-msg_boot db "Switching to Bubbles kernel...", 13, 10, 0
-msg_err  db "Disk read error!", 13, 10, 0
+msg_boot db "Switching to Bubbles kernel", 0
+msg_crlf db 13, 10, 0
+msg_err  db 13, 10, "Disk read error!", 13, 10, 0
 BootDrive db 0
+Lba       dw 1
+Left      dw KERNEL_SECTORS
 times 510-($-$$) db 0
 dw 0xAA55
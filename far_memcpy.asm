@@ -0,0 +1,81 @@
+; far_memcpy / far_memsetw for 16-bit NASM
+; Function signatures:
+; void far_memcpy(farptr_t dst, farptr_t src, unsigned short len)
+; void far_memsetw(farptr_t dst, unsigned short value, unsigned short count)
+;
+; far_memcpy copies `len` bytes between two far addresses (segment:offset).
+; The regions must not overlap unless dst is below src. far_memsetw fills
+; `count` words with `value`. No offset may wrap past the end of its segment.
+
+BITS 16
+
+section .text
+global far_memcpy
+global far_memsetw
+
+far_memcpy:
+    push bp
+    mov  bp, sp
+    push cx
+    push si
+    push di
+    push ds
+    push es
+
+    ; Stack layout (16-bit):
+    ; [bp+0]  = old BP
+    ; [bp+2]  = return address
+    ; [bp+4]  = destination offset (word)
+    ; [bp+6]  = destination segment (word)
+    ; [bp+8]  = source offset (word)
+    ; [bp+10] = source segment (word)
+    ; [bp+12] = length in bytes (word)
+
+    mov  di, [bp+4]
+    mov  es, [bp+6]
+    mov  si, [bp+8]
+    mov  cx, [bp+12]
+    mov  ds, [bp+10]    ; Last: BP-relative loads use SS, not DS
+
+    cld
+    shr  cx, 1          ; Move words, then the odd byte if any
+    rep  movsw
+    jnc  .done
+    movsb
+
+.done:
+    pop  es
+    pop  ds
+    pop  di
+    pop  si
+    pop  cx
+    pop  bp
+    ret
+
+far_memsetw:
+    push bp
+    mov  bp, sp
+    push cx
+    push di
+    push es
+
+    ; Stack layout (16-bit):
+    ; [bp+0]  = old BP
+    ; [bp+2]  = return address
+    ; [bp+4]  = destination offset (word)
+    ; [bp+6]  = destination segment (word)
+    ; [bp+8]  = fill value (word)
+    ; [bp+10] = count in words (word)
+
+    mov  di, [bp+4]
+    mov  es, [bp+6]
+    mov  ax, [bp+8]
+    mov  cx, [bp+10]
+    cld
+    rep  stosw
+
+    pop  es
+    pop  di
+    pop  cx
+    pop  bp
+    ret
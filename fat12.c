@@ -0,0 +1,1578 @@
+// FAT12 file system: geometry, FAT and root directory caches, the name
+// index, extent maps, the streaming reader and the write paths
+#include <stdint.h>
+#include "runtime.h"
+#include "fat12.h"
+
+static const struct media_profile media_profiles[] = {
+    { "360K",   720,  9, 2, 0xFD },
+    { "720K",  1440,  9, 2, 0xF9 },
+    { "1.2M",  2400, 15, 2, 0xF9 },
+    { "1.44M", 2880, 18, 2, 0xF0 },
+    { "2.88M", 5760, 36, 2, 0xF0 },
+};
+
+#define MEDIA_PROFILE_COUNT (sizeof(media_profiles) / sizeof(media_profiles[0]))
+
+struct disk_geometry disk_geom;
+
+// Fill `geom` from a boot sector. Returns 0 on success, -1 if the BPB is
+// unusable or contradicts the standard profile for its size.
+static int disk_geometry_init(struct disk_geometry *geom, const struct fat12_boot_sector *bs,
+                              unsigned char drive) {
+    if (bs->sectors_per_track == 0 || bs->sectors_per_track > 128 ||
+        bs->num_heads == 0 || bs->num_heads > 255 ||
+        bs->sectors_per_cluster == 0 || bs->sectors_per_cluster > 64 ||
+        (bs->sectors_per_cluster & (bs->sectors_per_cluster - 1)) ||
+        bs->root_entries > FAT12_MAX_ROOT_SECTORS * 16) {
+        return -1;
+    }
+
+    geom->drive = drive;
+    geom->sectors_per_track = bs->sectors_per_track;
+    geom->num_heads = bs->num_heads;
+    geom->sectors_per_cylinder = bs->sectors_per_track * bs->num_heads;
+    geom->total_sectors = bs->total_sectors_short ? bs->total_sectors_short
+                                                  : (unsigned short)bs->total_sectors_long;
+    geom->cylinders = geom->total_sectors / geom->sectors_per_cylinder;
+
+    geom->fat_lba = bs->reserved_sectors;
+    geom->root_lba = geom->fat_lba + bs->num_fats * bs->sectors_per_fat;
+    geom->root_sectors = udiv32_16(umul16x16(bs->root_entries, 32) + 511, 512, 0);
+    geom->data_lba = geom->root_lba + geom->root_sectors;
+    geom->cluster_sectors = bs->sectors_per_cluster;
+    geom->cluster_bytes = bs->sectors_per_cluster * 512;
+
+    if (bs->sectors_per_fat > FAT12_MAX_FAT_SECTORS ||
+        geom->data_lba >= geom->total_sectors) {
+        return -1;
+    }
+    geom->cluster_count = (geom->total_sectors - geom->data_lba) / geom->cluster_sectors;
+
+    geom->profile = 0;
+    for (unsigned int i = 0; i < MEDIA_PROFILE_COUNT; i++) {
+        const struct media_profile *p = &media_profiles[i];
+        if (p->total_sectors != geom->total_sectors) continue;
+
+        if (p->sectors_per_track != geom->sectors_per_track ||
+            p->num_heads != geom->num_heads ||
+            p->media_descriptor != bs->media_descriptor) {
+            return -1;
+        }
+        geom->profile = p;
+        break;
+    }
+    return 0;
+}
+
+// Position `pos` at `lba`; the only place a division is needed
+void chs_seek(const struct disk_geometry *geom, struct chs_cursor *pos, unsigned int lba) {
+    unsigned int temp = lba % geom->sectors_per_cylinder;
+    pos->cyl = lba / geom->sectors_per_cylinder;
+    pos->head = 0;
+    while (temp >= geom->sectors_per_track) {
+        temp -= geom->sectors_per_track;
+        pos->head++;
+    }
+    pos->sector = temp + 1;
+}
+
+// Move `pos` forward by `n` sectors, carrying sector -> head -> cylinder
+void chs_advance(const struct disk_geometry *geom, struct chs_cursor *pos, unsigned int n) {
+    n += pos->sector;
+    while (n > geom->sectors_per_track) {
+        n -= geom->sectors_per_track;
+        if (++pos->head == geom->num_heads) {
+            pos->head = 0;
+            pos->cyl++;
+        }
+    }
+    pos->sector = n;
+}
+
+struct fat12_boot_sector boot_sector;
+static farptr_t fat_sectors[FAT12_MAX_FAT_SECTORS];  // From disk_sector_alloc
+static unsigned char root_dir_buffer[512 * FAT12_MAX_ROOT_SECTORS];
+unsigned char fat12_initialized = 0;
+
+// Lazy mount: FAT and root directory sectors are read on first use.
+// Bit n is set once sector n of the FAT (or root directory) is resident.
+unsigned char fat12_lazy = 1;
+static uint16_t fat_resident;
+static uint16_t root_resident;
+
+// Writes change FAT and root directory sectors in memory and only mark
+// them here; fat12_sync writes them out, the FAT to every copy
+static uint16_t fat_dirty;
+static uint16_t root_dirty;
+
+// Free-cluster bitmap (bit set: free), built from the FAT before the first
+// allocation, or at mount when eager
+#define FAT12_MAX_ENTRIES (FAT12_MAX_FAT_SECTORS * 512 * 2 / 3)
+
+static unsigned char free_map[FAT12_MAX_ENTRIES / 8];
+static unsigned char free_map_valid;
+static unsigned int free_count;
+
+// Last subdirectory sector read, so a scan costs one read per sector
+static unsigned char dir_buf[512];
+static unsigned int dir_buf_lba;             // 0: none (LBA 0 is the boot sector)
+static unsigned char dir_read_error;         // Set when a directory scan hit one
+static uint32_t dir_sector_reads;
+
+// Helper function to read the FAT12 boot sector from floppy A:. The whole
+// sector goes to a scratch buffer; only the BPB is kept.
+static int fat12_read_boot_sector(void) {
+    if (disk_read_boot_sector(FLOPPY_DRIVE_A, stream_buf[0])) {
+        return -1;
+    }
+    far_memcpy(near_to_far(&boot_sector), near_to_far(stream_buf[0]), sizeof(boot_sector));
+    return 0;
+}
+
+static int fat12_load_fat_sector(unsigned int n);
+static int fat12_build_free_map(void);
+
+// Helper function to read the FAT from floppy A:
+static int fat12_read_fat(void) {
+    for (unsigned int n = 0; n < boot_sector.sectors_per_fat; n++) {
+        if (fat12_load_fat_sector(n)) return -1;
+    }
+    return 0;
+}
+
+// Give the FAT sector buffers back, e.g. before a remount
+static void fat12_release_fat(void) {
+    for (unsigned int n = 0; n < FAT12_MAX_FAT_SECTORS; n++) {
+        if (fat_resident & (1u << n)) disk_sector_free(fat_sectors[n]);
+    }
+    fat_resident = 0;
+}
+
+// Helper function to read root directory from floppy A:
+static int fat12_read_root_dir(void) {
+    if (disk_read_sectors(disk_geom.root_lba, disk_geom.root_sectors,
+                           near_to_far(root_dir_buffer))) {
+        return -1;
+    }
+    root_resident = (1u << disk_geom.root_sectors) - 1;
+    return 0;
+}
+
+// Make FAT sector `n` resident
+static int fat12_load_fat_sector(unsigned int n) {
+    if (fat_resident & (1u << n)) return 0;
+
+    farptr_t buf = disk_sector_alloc();
+    if (!buf) return -1;
+    if (disk_read_sectors(disk_geom.fat_lba + n, 1, buf)) {
+        disk_sector_free(buf);
+        return -1;
+    }
+    fat_sectors[n] = buf;
+    fat_resident |= 1u << n;
+    return 0;
+}
+
+// Make root directory sector `n` resident
+static int fat12_load_root_sector(unsigned int n) {
+    if (root_resident & (1u << n)) return 0;
+    if (disk_read_sectors(disk_geom.root_lba + n, 1, near_to_far(&root_dir_buffer[n * 512]))) {
+        return -1;
+    }
+    root_resident |= 1u << n;
+    return 0;
+}
+
+static unsigned int fat12_count_bits(uint16_t v) {
+    unsigned int n = 0;
+    for (; v; v &= v - 1) n++;
+    return n;
+}
+
+unsigned short fat12_get_next_cluster(unsigned short cluster) {
+    unsigned int fat_offset = cluster + (cluster / 2);  // cluster * 1.5
+
+    // A 12-bit entry can straddle two FAT sectors; a read failure ends the
+    // chain on a bad-cluster marker so callers stop with an error
+    if (fat_offset + 1 >= boot_sector.sectors_per_fat * 512 ||
+        fat12_load_fat_sector(fat_offset >> 9) ||
+        fat12_load_fat_sector((fat_offset + 1) >> 9)) {
+        return 0xFF7;
+    }
+
+    // Both bytes, each from its own sector buffer
+    unsigned char ptr[2];
+    unsigned short next_cluster;
+    unsigned int off = fat_offset & 511;
+    if (off < 511) {
+        far_memcpy(near_to_far(ptr), FAR_ADD(fat_sectors[fat_offset >> 9], off), 2);
+    } else {
+        far_memcpy(near_to_far(ptr), FAR_ADD(fat_sectors[fat_offset >> 9], off), 1);
+        far_memcpy(near_to_far(ptr + 1), fat_sectors[(fat_offset >> 9) + 1], 1);
+    }
+    next_cluster = ptr[0] | (ptr[1] << 8);  // Manual little-endian read
+
+    if (cluster & 1) {
+        next_cluster >>= 4;  // Odd cluster, use high 12 bits
+    } else {
+        next_cluster &= 0x0FFF;  // Even cluster, use low 12 bits
+    }
+
+    return next_cluster;
+}
+
+// Cluster `index` (from 0) of the chain starting at `cluster`; 0 if the
+// chain is shorter or broken
+static unsigned short fat12_chain_at(unsigned short cluster, uint32_t index) {
+    for (;;) {
+        if (cluster < 2 || cluster - 2 >= disk_geom.cluster_count) return 0;
+        if (!index--) return cluster;
+        cluster = fat12_get_next_cluster(cluster);
+    }
+}
+
+// Convert 8.3 filename to padded format (keep as-is)
+static void format_filename(const char *input, char *output) {
+    int i, j;
+
+    for (i = 0; i < 11; i++) {
+        output[i] = ' ';
+    }
+    output[11] = 0;
+
+    for (i = 0; i < 8 && input[i] && input[i] != '.'; i++) {
+        output[i] = input[i];
+        if (output[i] >= 'a' && output[i] <= 'z') {
+            output[i] -= 32;
+        }
+    }
+
+    const char *ext = input;
+    while (*ext && *ext != '.') ext++;
+    if (*ext == '.') {
+        ext++;
+        for (j = 0; j < 3 && ext[j]; j++) {
+            output[8 + j] = ext[j];
+            if (output[8 + j] >= 'a' && output[8 + j] <= 'z') {
+                output[8 + j] -= 32;
+            }
+        }
+    }
+}
+
+// Print an entry's name as NAME.EXT
+static void fat12_print_name(const struct fat12_dir_entry *entry) {
+    // Print filename (handle 0x05 special case - should be 0xE5)
+    for (int j = 0; j < 8; j++) {
+        unsigned char c = entry->name[j];
+        if (c == ' ') break;
+        if (c == 0x05) c = 0xE5;  // Special case for Japanese characters
+        console_putc(c);
+    }
+
+    // Print extension if present
+    if (entry->ext[0] != ' ' && entry->ext[0] != 0) {
+        console_putc('.');
+        for (int j = 0; j < 3; j++) {
+            unsigned char c = entry->ext[j];
+            if (c == ' ' || c == 0) break;
+            console_putc(c);
+        }
+    }
+}
+
+// Slot of `entry` in the root directory, -1 for a copy of an entry from
+// a subdirectory. Only root entries can be written.
+static int fat12_root_slot(const struct fat12_dir_entry *entry) {
+    const struct fat12_dir_entry *entries = (const struct fat12_dir_entry *)root_dir_buffer;
+
+    if (entry < entries || entry >= entries + boot_sector.root_entries) return -1;
+    return entry - entries;
+}
+
+// Sector `n` of the directory starting at cluster `dir` (0 for the root)
+// as 16 entries; 0 past the end of the directory or on a read error
+static struct fat12_dir_entry *fat12_dir_sector(unsigned short dir, unsigned int n) {
+    if (!dir) {
+        if (n >= disk_geom.root_sectors) return 0;
+        if (fat12_load_root_sector(n)) {
+            dir_read_error = 1;
+            return 0;
+        }
+        return (struct fat12_dir_entry *)&root_dir_buffer[n * 512];
+    }
+
+    unsigned int index = 0;
+    while (n >= disk_geom.cluster_sectors) {
+        n -= disk_geom.cluster_sectors;
+        index++;
+    }
+    unsigned short cluster = fat12_chain_at(dir, index);
+    if (!cluster) return 0;
+
+    unsigned int lba = fat12_cluster_lba(cluster) + n;
+    if (lba != dir_buf_lba) {
+        dir_buf_lba = 0;
+        if (disk_read_sectors(lba, 1, near_to_far(dir_buf))) {
+            dir_read_error = 1;
+            return 0;
+        }
+        dir_buf_lba = lba;
+        dir_sector_reads++;
+    }
+    return (struct fat12_dir_entry *)dir_buf;
+}
+
+// Next live entry at or after *slot in the directory starting at cluster
+// `dir` (0 for the root), with *slot moved past it; 0 at the end of the
+// directory. Entries of a subdirectory are only valid until the next
+// directory read.
+struct fat12_dir_entry *fat12_dir_next(unsigned short dir, unsigned int *slot) {
+    struct fat12_dir_entry *sector = 0;
+
+    for (unsigned int i = *slot; dir || i < boot_sector.root_entries; i++) {
+        if ((!sector || (i & 15) == 0) && !(sector = fat12_dir_sector(dir, i >> 4))) break;
+
+        struct fat12_dir_entry *entry = &sector[i & 15];
+        if (entry->name[0] == 0x00) break;
+        if ((unsigned char)entry->name[0] == 0xE5 || (entry->attr & 0x08)) continue;
+
+        *slot = i + 1;
+        return entry;
+    }
+    return 0;
+}
+
+// List the root directory, or the directory at `path`. Returns the first
+// cluster of the directory listed (0 for the root), -1 on error.
+int fat12_list_files(const char *path) {
+    if (!fat12_initialized) {
+        console_puts("Error: FAT12 not mounted! Use 'mount' first.");
+        console_newline();
+        return -1;
+    }
+
+    unsigned short dir = 0;
+    while (*path == '/' || *path == '\\') path++;
+    if (path[0]) {
+        struct fat12_dir_entry *d = fat12_find_file(path);
+        if (!d || !(d->attr & 0x10)) {
+            console_puts("Directory not found!");
+            console_newline();
+            return -1;
+        }
+        dir = d->start_cluster;
+    }
+
+    console_puts("Files on A:/");
+    console_puts(path);
+    console_newline();
+
+    unsigned int file_count = 0;
+    unsigned int slot = 0;
+    struct fat12_dir_entry *entry;
+
+    dir_read_error = 0;
+    while ((entry = fat12_dir_next(dir, &slot))) {
+        // Additional validation: check if name has printable characters
+        int valid = 0;
+        for (int j = 0; j < 8; j++) {
+            unsigned char c = entry->name[j];
+            // Check for printable ASCII or space
+            if ((c >= 0x20 && c <= 0x7E) || c == 0x05) {
+                valid = 1;
+                break;
+            }
+        }
+
+        if (!valid) {
+            continue;  // Skip entries with non-printable names
+        }
+
+        file_count++;
+
+        fat12_print_name(entry);
+
+        // Print info
+        if (entry->attr & 0x10) {
+            console_puts(" <DIR>");
+        } else {
+            console_puts(" ");
+            console_putdec(entry->size);
+            console_puts(" bytes");
+        }
+
+        console_newline();
+    }
+    if (dir_read_error) {
+        console_puts("Error: Cannot read directory!");
+        console_newline();
+    }
+
+    console_newline();
+    console_putdec(file_count);
+    console_puts(" file(s)");
+    if (free_map_valid) {
+        console_puts(", ");
+        console_putdec(umul16x16(free_count, disk_geom.cluster_bytes));
+        console_puts(" bytes free");
+    }
+    console_newline();
+    return dir;
+}
+
+// Read `count` physically consecutive clusters starting at `cluster`
+static int fat12_read_clusters(unsigned short cluster, unsigned int count, farptr_t buffer) {
+    if (!fat12_initialized) return -1;
+
+    if (cluster < 2) return -1;
+
+    // Reject chains that point past the end of the volume
+    uint32_t sector = disk_geom.data_lba + umul16x16(cluster - 2, disk_geom.cluster_sectors);
+    uint32_t sectors = umul16x16(count, disk_geom.cluster_sectors);
+    if (sector + sectors > disk_geom.total_sectors) return -1;
+
+    return disk_read_sectors(sector, sectors, buffer);
+}
+
+// Extent maps: a file's cluster chain as (LBA, sector count) runs, built
+// once per file and kept for the most recently used files
+#define EXTENT_MAX         16
+#define EXTENT_CACHE_FILES 4
+
+struct fat12_extent {
+    unsigned short lba;
+    unsigned short sectors;
+};
+
+struct fat12_extent_map {
+    unsigned short start_cluster;    // 0: slot unused
+    uint32_t       size;
+    unsigned short last_used;        // LRU stamp
+    unsigned short fragments;        // Extents in the whole chain
+    unsigned char  count;            // Extents stored in ext[]
+    unsigned short resume_cluster;   // First cluster not in ext[]
+    uint32_t       mapped_bytes;     // File bytes covered by ext[]
+    struct fat12_extent ext[EXTENT_MAX];
+};
+
+static struct fat12_extent_map extent_cache[EXTENT_CACHE_FILES];
+static unsigned short extent_clock;
+
+static void fat12_extent_cache_flush(void) {
+    for (unsigned int i = 0; i < EXTENT_CACHE_FILES; i++) {
+        extent_cache[i].start_cluster = 0;
+    }
+}
+
+// Walk the chain of a file once, merging physically adjacent clusters.
+// Chains longer than EXTENT_MAX runs keep their tail as a resume cluster.
+static int fat12_build_extents(struct fat12_extent_map *map, unsigned short cluster,
+                               uint32_t size) {
+    uint32_t remaining = size;
+    unsigned short prev_end = 0;
+    unsigned char truncated = 0;
+
+    map->count = 0;
+    map->fragments = 0;
+    map->resume_cluster = 0;
+
+    while (remaining) {
+        if (cluster < 2 || cluster - 2 >= disk_geom.cluster_count) return -1;
+
+        unsigned short lba = disk_geom.data_lba + (cluster - 2) * disk_geom.cluster_sectors;
+        if (!map->fragments || lba != prev_end) {
+            map->fragments++;
+            if (!truncated && map->count == EXTENT_MAX) {
+                truncated = 1;
+                map->resume_cluster = cluster;
+                map->mapped_bytes = size - remaining;
+            }
+            if (!truncated) {
+                map->ext[map->count].lba = lba;
+                map->ext[map->count].sectors = 0;
+                map->count++;
+            }
+        }
+        if (!truncated) map->ext[map->count - 1].sectors += disk_geom.cluster_sectors;
+        prev_end = lba + disk_geom.cluster_sectors;
+
+        if (remaining <= disk_geom.cluster_bytes) break;
+        remaining -= disk_geom.cluster_bytes;
+        cluster = fat12_get_next_cluster(cluster);
+    }
+
+    if (!truncated) map->mapped_bytes = size;
+    return 0;
+}
+
+// Extent map for `file`, from the cache or freshly built
+static struct fat12_extent_map* fat12_get_extents(const struct fat12_dir_entry *file) {
+    struct fat12_extent_map *map = 0;
+
+    for (unsigned int i = 0; i < EXTENT_CACHE_FILES; i++) {
+        struct fat12_extent_map *m = &extent_cache[i];
+        if (m->start_cluster && m->start_cluster == file->start_cluster &&
+            m->size == file->size) {
+            m->last_used = ++extent_clock;
+            return m;
+        }
+        if (!map || !m->start_cluster ||
+            (map->start_cluster && (unsigned short)(extent_clock - m->last_used) >
+                                   (unsigned short)(extent_clock - map->last_used))) {
+            map = m;
+        }
+    }
+
+    map->start_cluster = 0;
+    if (fat12_build_extents(map, file->start_cluster, file->size)) return 0;
+    map->start_cluster = file->start_cluster;
+    map->size = file->size;
+    map->last_used = ++extent_clock;
+    return map;
+}
+
+// Read `remaining` bytes by walking the chain from `cluster`, one transfer
+// per physically contiguous run
+static int fat12_read_chain(unsigned short cluster, uint32_t remaining, farptr_t dst,
+                            uint32_t max_size) {
+    while (cluster < 0xFF8) { // FAT12 end-of-chain >= 0xFF8
+        if (remaining == 0) break;
+
+        // Extend the run while the chain stays physically contiguous
+        unsigned short first = cluster;
+        unsigned int count = 1;
+        uint32_t run_bytes = disk_geom.cluster_bytes;
+        unsigned short next = fat12_get_next_cluster(cluster);
+
+        while (next == cluster + 1 && run_bytes < remaining) {
+            cluster = next;
+            count++;
+            run_bytes += disk_geom.cluster_bytes;
+            next = fat12_get_next_cluster(cluster);
+        }
+
+        // Whole clusters are transferred, so they must all fit
+        if (run_bytes > max_size) return -1; // Buffer too small
+
+        if (fat12_read_clusters(first, count, dst)) return -1;
+
+        if (run_bytes > remaining) run_bytes = remaining;
+        dst = FAR_ADD_SECTORS(dst, count * disk_geom.cluster_sectors);
+        remaining -= run_bytes;
+        max_size -= run_bytes;
+
+        cluster = next;
+    }
+    return remaining ? -1 : 0;
+}
+
+long fat12_read_file(const struct fat12_dir_entry *file, farptr_t dst,
+                     uint32_t max_size) {
+    struct fat12_extent_map *map = fat12_get_extents(file);
+    if (!map) return -1;
+
+    uint32_t left = map->mapped_bytes;
+    uint32_t room = max_size;
+
+    // One request per extent; the track cache splits it per track
+    for (unsigned int i = 0; i < map->count; i++) {
+        unsigned int sectors = map->ext[i].sectors;
+        uint32_t bytes = (uint32_t)sectors << 9;
+
+        // Whole clusters are transferred, so they must all fit
+        if (bytes > room) return -1; // Buffer too small
+
+        if (disk_read_sectors(map->ext[i].lba, sectors, dst)) return -1;
+
+        if (bytes > left) bytes = left;
+        dst = FAR_ADD_SECTORS(dst, sectors);
+        left -= bytes;
+        room -= bytes;
+    }
+
+    // Chains with more runs than the map holds continue the slow way
+    if (map->mapped_bytes < file->size &&
+        fat12_read_chain(map->resume_cluster, file->size - map->mapped_bytes, dst, room)) {
+        return -1;
+    }
+
+    return file->size; // Return bytes read
+}
+
+// Root directory index: open-addressed hash of the 11-byte on-disk name to
+// the entry's slot in root_dir_buffer, rebuilt on every mount
+#define ROOT_INDEX_SIZE  512         // Power of two, over twice the entries
+#define ROOT_INDEX_EMPTY 0xFF        // Entry numbers stay below 240
+
+typedef uint16_t __attribute__((may_alias)) alias_u16;
+
+static unsigned char root_index[ROOT_INDEX_SIZE];
+static unsigned int root_index_count;
+static unsigned int root_index_max_probe;
+static unsigned int root_index_scanned;      // Entries examined so far
+static unsigned char root_index_complete;    // End of directory reached
+static uint32_t root_index_build_us;
+static uint32_t root_index_lookups;
+static uint32_t root_index_probes;
+
+static unsigned int fat12_name_hash(const unsigned char *name) {
+    unsigned int h = 0;
+    for (int i = 0; i < 11; i++) h = h * 31 + name[i];
+    return (h ^ (h >> 9)) & (ROOT_INDEX_SIZE - 1);
+}
+
+// Fixed-width compare of two 11-byte names: five words and a byte
+static inline int fat12_name_eq(const unsigned char *a, const unsigned char *b) {
+    const alias_u16 *x = (const alias_u16 *)a;
+    const alias_u16 *y = (const alias_u16 *)b;
+    return x[0] == y[0] && x[1] == y[1] && x[2] == y[2] && x[3] == y[3] &&
+           x[4] == y[4] && a[10] == b[10];
+}
+
+static void fat12_index_reset(void) {
+    for (unsigned int i = 0; i < ROOT_INDEX_SIZE; i++) root_index[i] = ROOT_INDEX_EMPTY;
+    root_index_count = 0;
+    root_index_max_probe = 0;
+    root_index_scanned = 0;
+    root_index_complete = 0;
+    root_index_build_us = 0;
+}
+
+// Add root directory slot `slot` to the index
+static void fat12_index_insert(unsigned int slot) {
+    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+    unsigned int h = fat12_name_hash(entries[slot].name);
+    unsigned int probes = 1;
+
+    while (root_index[h] != ROOT_INDEX_EMPTY) {
+        h = (h + 1) & (ROOT_INDEX_SIZE - 1);
+        probes++;
+    }
+    root_index[h] = slot;
+    root_index_count++;
+    if (probes > root_index_max_probe) root_index_max_probe = probes;
+}
+
+// Index the next root directory sector (loading it if needed). Returns -1
+// once the whole directory is indexed or on a read error; after an error
+// the index stays incomplete, so the next lookup tries the sector again.
+static int fat12_index_extend(void) {
+    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+
+    if (root_index_complete) return -1;
+    if (root_index_scanned >= boot_sector.root_entries) {
+        root_index_complete = 1;
+        return -1;
+    }
+    if (fat12_load_root_sector(root_index_scanned >> 4)) return -1;
+
+    uint32_t start = timer_us();
+    unsigned int end = root_index_scanned + 16;
+    if (end > boot_sector.root_entries) end = boot_sector.root_entries;
+
+    for (unsigned int i = root_index_scanned; i < end; i++) {
+        struct fat12_dir_entry *entry = &entries[i];
+
+        if (entry->name[0] == 0x00) {        // End of directory
+            root_index_complete = 1;
+            break;
+        }
+        if ((unsigned char)entry->name[0] == 0xE5) continue; // Deleted
+        if (entry->attr & 0x08) continue;   // Volume label
+        if (entry->attr == 0x0F) continue;  // LFN entry
+
+        fat12_index_insert(i);
+    }
+
+    root_index_scanned = end;
+    if (end >= boot_sector.root_entries) root_index_complete = 1;
+    root_index_build_us += timer_us() - start;
+    return 0;
+}
+
+static void fat12_build_index(void) {
+    fat12_index_reset();
+    while (!fat12_index_extend());
+}
+
+// Lookup through the index; in lazy mode, directory sectors not yet seen
+// are read and indexed until the name turns up or the directory ends
+static struct fat12_dir_entry *fat12_root_lookup(const unsigned char *name) {
+    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+    unsigned int start = fat12_name_hash(name);
+
+    root_index_lookups++;
+    do {
+        unsigned int h = start;
+        while (root_index[h] != ROOT_INDEX_EMPTY) {
+            struct fat12_dir_entry *entry = &entries[root_index[h]];
+            root_index_probes++;
+            if (fat12_name_eq(entry->name, name)) return entry;
+            h = (h + 1) & (ROOT_INDEX_SIZE - 1);
+        }
+    } while (!fat12_index_extend());
+
+    return 0; // Not found
+}
+
+// Dentry cache: (directory cluster, name) -> copy of the entry, for names
+// in subdirectories, with negative entries for names that are not there.
+// The root needs none, its index answers without reading. Flushed on
+// mount; subdirectories are never written, so nothing else goes stale.
+#define DENTRY_CACHE_SIZE 32
+
+struct fat12_dentry {
+    unsigned short parent;           // First cluster of the directory; 0: unused
+    unsigned short last_used;        // LRU stamp
+    unsigned char  negative;         // Name known to be absent
+    struct fat12_dir_entry entry;    // entry.name and entry.ext are the key
+};
+
+static struct fat12_dentry dentry_cache[DENTRY_CACHE_SIZE];
+static unsigned short dentry_clock;
+static uint32_t dentry_hits;
+static uint32_t dentry_misses;
+
+static void fat12_dentry_flush(void) {
+    for (unsigned int i = 0; i < DENTRY_CACHE_SIZE; i++) dentry_cache[i].parent = 0;
+    dir_buf_lba = 0;
+}
+
+// Entry `name` (on-disk form) in the subdirectory starting at `dir`; a
+// miss scans the directory once and caches the outcome either way
+static struct fat12_dir_entry *fat12_dir_lookup(unsigned short dir, const unsigned char *name) {
+    struct fat12_dentry *d = 0;
+
+    for (unsigned int i = 0; i < DENTRY_CACHE_SIZE; i++) {
+        struct fat12_dentry *c = &dentry_cache[i];
+        if (c->parent == dir && fat12_name_eq(c->entry.name, name)) {
+            c->last_used = ++dentry_clock;
+            dentry_hits++;
+            return c->negative ? 0 : &c->entry;
+        }
+        if (!d || !c->parent ||
+            (d->parent && (unsigned short)(dentry_clock - c->last_used) >
+                          (unsigned short)(dentry_clock - d->last_used))) {
+            d = c;
+        }
+    }
+    dentry_misses++;
+
+    struct fat12_dir_entry *entry;
+    unsigned int slot = 0;
+    dir_read_error = 0;
+    while ((entry = fat12_dir_next(dir, &slot)) && !fat12_name_eq(entry->name, name)) {
+    }
+    if (!entry && dir_read_error) return 0;  // Not known to be absent
+
+    d->parent = dir;
+    d->last_used = ++dentry_clock;
+    d->negative = !entry;
+    if (entry) {
+        far_memcpy(near_to_far(&d->entry), near_to_far(entry), sizeof(d->entry));
+        return &d->entry;
+    }
+    far_memcpy(near_to_far(d->entry.name), near_to_far((void *)name), 11);
+    return 0;
+}
+
+// Resolve a path such as "NAME.EXT", "/DIR/NAME.EXT" or "DIR\SUB": the
+// root through its index, subdirectories through the dentry cache, so a
+// path seen before costs no directory reads. Returns the entry or 0. An
+// entry from a subdirectory is a cached copy, valid until the next lookup.
+struct fat12_dir_entry *fat12_find_file(const char *path) {
+    struct fat12_dir_entry *entry = 0;
+    unsigned short dir = 0;
+
+    if (!fat12_initialized) return 0;
+
+    while (*path == '/' || *path == '\\') path++;
+    while (*path) {
+        char component[13];
+        char formatted[12];
+        unsigned int n = 0;
+
+        for (; *path && *path != '/' && *path != '\\'; path++) {
+            if (n == 12) return 0;           // Longer than any 8.3 name
+            component[n++] = *path;
+        }
+        component[n] = 0;
+        while (*path == '/' || *path == '\\') path++;
+
+        // "." and ".." are real entries in a subdirectory
+        if (component[0] == '.' && (!component[1] || (component[1] == '.' && !component[2]))) {
+            for (unsigned int i = 0; i < 11; i++) formatted[i] = ' ';
+            formatted[0] = '.';
+            if (component[1]) formatted[1] = '.';
+        } else {
+            format_filename(component, formatted); // Produces 8+3 padded string
+            if ((unsigned char)formatted[0] == 0xE5) formatted[0] = 0x05;  // Stored escaped
+        }
+
+        const unsigned char *name = (const unsigned char *)formatted;
+        entry = dir ? fat12_dir_lookup(dir, name) : fat12_root_lookup(name);
+        if (!entry || !*path) break;
+        if (!(entry->attr & 0x10)) return 0; // A file in the middle of the path
+        dir = entry->start_cluster;
+    }
+    return entry;
+}
+// One unit of background work on an idle mount: index the next root
+// directory sector, or else load the next FAT sector not yet resident.
+// Returns 0 once both are complete.
+int fat12_prefetch_step(void) {
+    if (!fat12_initialized) return 0;
+    if (!root_index_complete) {
+        // Stop on a read error rather than retry it every step
+        return !fat12_index_extend() || root_index_complete;
+    }
+    for (unsigned int n = 0; n < boot_sector.sectors_per_fat; n++) {
+        if (!(fat_resident & (1u << n))) return fat12_load_fat_sector(n) == 0;
+    }
+    return 0;
+}
+
+// First sector of `cluster`
+unsigned int fat12_cluster_lba(unsigned short cluster) {
+    return disk_geom.data_lba + umul16x16(cluster - 2, disk_geom.cluster_sectors);
+}
+
+// Index statistics; with a name, also time a batch of lookups of it
+void fat12_index_stat(const char *name) {
+    if (!fat12_initialized) {
+        console_puts("Error: FAT12 not mounted! Use 'mount' first.");
+        console_newline();
+        return;
+    }
+
+    console_puts("Root index: ");
+    console_putdec(root_index_count);
+    console_puts(" entries in ");
+    console_putdec(ROOT_INDEX_SIZE);
+    console_puts(" slots, longest probe ");
+    console_putdec(root_index_max_probe);
+    console_newline();
+    console_puts("Rebuild: ");
+    console_putdec(root_index_build_us);
+    console_puts(" us");
+    console_newline();
+    console_puts("Lookups: ");
+    console_putdec(root_index_lookups);
+    console_puts("  Probes: ");
+    console_putdec(root_index_probes);
+    console_newline();
+    console_puts("Resident: FAT ");
+    console_putdec(fat12_count_bits(fat_resident));
+    console_puts("/");
+    console_putdec(boot_sector.sectors_per_fat);
+    console_puts("  Root ");
+    console_putdec(fat12_count_bits(root_resident));
+    console_puts("/");
+    console_putdec(disk_geom.root_sectors);
+    console_puts(root_index_complete ? " (indexed)" : " (partial)");
+    console_newline();
+
+    unsigned int dentries = 0;
+    for (unsigned int i = 0; i < DENTRY_CACHE_SIZE; i++) {
+        if (dentry_cache[i].parent) dentries++;
+    }
+    console_puts("Dentries: ");
+    console_putdec(dentries);
+    console_puts("/");
+    console_putdec(DENTRY_CACHE_SIZE);
+    console_puts("  Hits: ");
+    console_putdec(dentry_hits);
+    console_puts("  Misses: ");
+    console_putdec(dentry_misses);
+    console_puts("  Dir sector reads: ");
+    console_putdec(dir_sector_reads);
+    console_newline();
+
+    if (name[0]) {
+        uint32_t start = timer_us();
+        for (unsigned int i = 0; i < 4096; i++) fat12_find_file(name);
+        uint32_t us = timer_us() - start;
+
+        console_puts("Lookup: ~");
+        console_putdec(us >> 12);    // 4096 lookups
+        console_puts(" us");
+        console_newline();
+    }
+}
+
+// FIXED: Initialize FAT12 with proper error handling
+int fat12_init(void) {
+    console_puts("Mounting A:...");
+    console_newline();
+
+    if (fat12_read_boot_sector()) {
+        console_puts("Error: Cannot read boot sector!");
+        console_newline();
+        fat12_initialized = 0;
+        return -1;
+    }
+
+    // Validate it's a proper FAT12 floppy
+    if (boot_sector.bytes_per_sector != 512) {
+        console_puts("Error: Invalid sector size!");
+        console_newline();
+        fat12_initialized = 0;
+        return -1;
+    }
+
+    if (disk_geometry_init(&disk_geom, &boot_sector, FLOPPY_DRIVE_A)) {
+        console_puts("Error: Invalid geometry!");
+        console_newline();
+        fat12_initialized = 0;
+        return -1;
+    }
+
+    if (disk_geom.profile) {
+        console_puts("Media: ");
+        console_puts(disk_geom.profile->name);
+    } else {
+        console_puts("Media: non-standard");
+    }
+    console_newline();
+
+    disk_configure(&disk_geom);
+
+    fat12_release_fat();
+    root_resident = 0;
+    fat_dirty = 0;
+    root_dirty = 0;
+    free_map_valid = 0;
+    fat12_index_reset();
+    fat12_dentry_flush();
+    fat12_extent_cache_flush();
+
+    // Lazy mode stops here: everything else is read on demand
+    if (!fat12_lazy) {
+        if (fat12_read_fat()) {
+            console_puts("Error: Cannot read FAT!");
+            console_newline();
+            fat12_initialized = 0;
+            return -1;
+        }
+
+        if (fat12_read_root_dir()) {
+            console_puts("Error: Cannot read root directory!");
+            console_newline();
+            fat12_initialized = 0;
+            return -1;
+        }
+    }
+
+    fat12_initialized = 1;
+    if (!fat12_lazy) {
+        fat12_build_index();
+        fat12_build_free_map();
+    }
+    console_puts("A: mounted successfully!");
+    console_newline();
+    return 0;
+}
+
+// Streaming reader: walks the cluster chain a chunk at a time, so memory
+// use is independent of the file size
+unsigned char stream_buf[2][STREAM_CHUNK_BYTES];
+
+int fat12_open(const struct fat12_dir_entry *entry, struct fat12_file *f) {
+    if (!fat12_initialized || (entry->attr & 0x18)) return -1;
+    f->dir_slot = fat12_root_slot(entry);
+    f->start_cluster = entry->start_cluster;
+    f->cluster = entry->start_cluster;
+    f->size = entry->size;
+    f->pos = 0;
+    return 0;
+}
+
+void fat12_close(struct fat12_file *f) {
+    f->size = 0;
+    f->pos = 0;
+}
+
+// Position at `offset` by following the FAT only; skipped clusters are
+// never read
+int fat12_seek(struct fat12_file *f, uint32_t offset) {
+    if (offset > f->size) offset = f->size;
+
+    uint32_t skip = udiv32_16(offset, disk_geom.cluster_bytes, 0);
+    unsigned short cluster = f->start_cluster;
+    for (uint32_t i = 0; i < skip; i++) {
+        if (cluster < 2 || cluster - 2 >= disk_geom.cluster_count) return -1;
+        cluster = fat12_get_next_cluster(cluster);
+    }
+
+    f->cluster = cluster;
+    f->pos = offset;
+    return 0;
+}
+
+// LBA of the sector holding f->pos and the sectors left in its cluster
+static int fat12_locate(const struct fat12_file *f, unsigned int *lba, unsigned int *left) {
+    if (f->cluster < 2 || f->cluster - 2 >= disk_geom.cluster_count) return -1;
+
+    unsigned int first = umod32_16(f->pos, disk_geom.cluster_bytes) >> 9;
+    *lba = disk_geom.data_lba + (f->cluster - 2) * disk_geom.cluster_sectors + first;
+    *left = disk_geom.cluster_sectors - first;
+    return 0;
+}
+
+// Move past `bytes` already consumed; never crosses a cluster boundary
+static void fat12_advance(struct fat12_file *f, unsigned int bytes) {
+    f->pos += bytes;
+    if (umod32_16(f->pos, disk_geom.cluster_bytes) == 0) {
+        f->cluster = fat12_get_next_cluster(f->cluster);
+    }
+}
+
+// Read the next chunk (at most `len` bytes, never past the current
+// cluster) into `buf`. File data starts at buf + *start because reads are
+// whole sectors. Returns the bytes of file data, 0 at end of file, -1 on
+// error.
+long fat12_read_chunk(struct fat12_file *f, void *buf, unsigned int len,
+                      unsigned int *start) {
+    unsigned int lba, sectors;
+
+    if (f->pos >= f->size) return 0;
+    if (fat12_locate(f, &lba, &sectors)) return -1;
+    if (sectors > (len >> 9)) sectors = len >> 9;
+    if (sectors == 0) return -1;
+
+    if (disk_read_sectors(lba, sectors, near_to_far(buf))) return -1;
+
+    unsigned int offset = (uint16_t)f->pos & 511;
+    uint32_t avail = (sectors << 9) - offset;
+    if (avail > f->size - f->pos) avail = f->size - f->pos;
+
+    fat12_advance(f, avail);
+    *start = offset;
+    return avail;
+}
+
+// Read up to `len` bytes into a far buffer. Whole sectors go straight from
+// the cache (or the drive) into `dst`; only a partial sector at either end
+// passes through a kernel buffer. Returns bytes read or -1.
+long fat12_read_far(struct fat12_file *f, farptr_t dst, unsigned int len) {
+    unsigned int done = 0;
+
+    if (len > f->size - f->pos) len = f->size - f->pos;
+
+    // Normalize so that whole-sector steps are pure segment adds
+    dst = FAR_NORM(dst);
+
+    while (done < len) {
+        unsigned int want = len - done;
+        unsigned int offset = (uint16_t)f->pos & 511;
+        unsigned int lba, sectors, bytes;
+
+        if (fat12_locate(f, &lba, &sectors)) return -1;
+
+        if (offset == 0 && want >= 512) {
+            if (sectors > (want >> 9)) sectors = want >> 9;
+            if (disk_read_sectors(lba, sectors, dst)) return -1;
+            bytes = sectors << 9;
+            dst = FAR_ADD_SECTORS(dst, sectors);
+        } else {
+            if (disk_read_sectors(lba, 1, near_to_far(stream_buf[0]))) return -1;
+            bytes = 512 - offset;
+            if (bytes > want) bytes = want;
+            far_memcpy(dst, near_to_far(stream_buf[0] + offset), bytes);
+            dst = FAR_ADD(dst, bytes);
+        }
+
+        fat12_advance(f, bytes);
+        done += bytes;
+    }
+    return done;
+}
+
+// Print `length` bytes of `entry` from `offset`, a chunk at a time through
+// stream_buf[0]. Each chunk is printed before the next is read; the reads
+// are synchronous, so a second buffer would have nothing to overlap with.
+int fat12_stream_out(const struct fat12_dir_entry *entry, uint32_t offset,
+                     uint32_t length) {
+    struct fat12_file f;
+    unsigned int start;
+    long n = 0;
+
+    if (fat12_open(entry, &f) || fat12_seek(&f, offset)) return -1;
+
+    while (length && (n = fat12_read_chunk(&f, stream_buf[0], STREAM_CHUNK_BYTES, &start)) > 0) {
+        unsigned int out = (uint32_t)n > length ? (unsigned int)length : (unsigned int)n;
+        console_write((const char *)stream_buf[0] + start, out);
+        length -= out;
+    }
+
+    fat12_close(&f);
+    return n < 0 ? -1 : 0;
+}
+
+static void fat12_print_frag(const struct fat12_dir_entry *entry) {
+    struct fat12_extent_map *map = fat12_get_extents(entry);
+
+    fat12_print_name(entry);
+    if (!map) {
+        console_puts(": broken cluster chain");
+        return;
+    }
+    console_puts(": ");
+    console_putdec(map->fragments);
+    console_puts(map->fragments == 1 ? " extent" : " extents");
+}
+
+// Fragmentation report: the extents of one file, or a count for every file
+void fat12_frag(const char *filename) {
+    if (!fat12_initialized) {
+        console_puts("Error: FAT12 not mounted! Use 'mount' first.");
+        return;
+    }
+
+    if (filename[0]) {
+        struct fat12_dir_entry *file = fat12_find_file(filename);
+        if (!file) {
+            console_puts("File not found!");
+            return;
+        }
+        fat12_print_frag(file);
+        struct fat12_extent_map *map = fat12_get_extents(file);
+        for (unsigned int i = 0; map && i < map->count; i++) {
+            console_newline();
+            console_puts("  LBA ");
+            console_putdec(map->ext[i].lba);
+            console_puts(" +");
+            console_putdec(map->ext[i].sectors);
+        }
+        if (map && map->mapped_bytes < file->size) {
+            console_newline();
+            console_puts("  ... chain continues at cluster ");
+            console_putdec(map->resume_cluster);
+        }
+        return;
+    }
+
+    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+    for (unsigned int i = 0; i < boot_sector.root_entries; i++) {
+        struct fat12_dir_entry *entry = &entries[i];
+
+        if ((i & 15) == 0 && fat12_load_root_sector(i >> 4)) break;
+        if (entry->name[0] == 0x00) break;
+        if ((unsigned char)entry->name[0] == 0xE5) continue;
+        if (entry->attr & 0x18) continue;   // Volume labels, LFNs, directories
+        if (entry->size == 0) continue;
+
+        fat12_print_frag(entry);
+        console_newline();
+    }
+}
+
+// Write support: create in the root directory, append, truncate, delete.
+// File data goes to disk_write_sectors as it is written; FAT and directory
+// changes stay in memory until fat12_sync.
+
+// Store `value` as the FAT entry of `cluster`, keeping the free map in step
+static int fat12_set_next_cluster(unsigned short cluster, unsigned short value) {
+    unsigned int fat_offset = cluster + (cluster / 2);
+    unsigned int n = fat_offset >> 9;
+    unsigned char ptr[2];
+
+    if (fat_offset + 1 >= boot_sector.sectors_per_fat * 512 ||
+        fat12_load_fat_sector(n) ||
+        fat12_load_fat_sector((fat_offset + 1) >> 9)) {
+        return -1;
+    }
+
+    // The two bytes may sit in different sector buffers
+    farptr_t lo = FAR_ADD(fat_sectors[n], fat_offset & 511);
+    farptr_t hi = (fat_offset & 511) < 511 ? FAR_ADD(lo, 1) : fat_sectors[n + 1];
+    far_memcpy(near_to_far(ptr), lo, 1);
+    far_memcpy(near_to_far(ptr + 1), hi, 1);
+
+    if (cluster & 1) {
+        ptr[0] = (ptr[0] & 0x0F) | ((value << 4) & 0xF0);
+        ptr[1] = value >> 4;
+    } else {
+        ptr[0] = value;
+        ptr[1] = (ptr[1] & 0xF0) | ((value >> 8) & 0x0F);
+    }
+
+    far_memcpy(lo, near_to_far(ptr), 1);
+    far_memcpy(hi, near_to_far(ptr + 1), 1);
+    fat_dirty |= (1u << n) | (1u << ((fat_offset + 1) >> 9));
+
+    if (free_map_valid) {
+        unsigned char bit = 1u << (cluster & 7);
+        unsigned char was_free = free_map[cluster >> 3] & bit;
+        if (!value && !was_free) {
+            free_map[cluster >> 3] |= bit;
+            free_count++;
+        } else if (value && was_free) {
+            free_map[cluster >> 3] &= ~bit;
+            free_count--;
+        }
+    }
+    return 0;
+}
+
+// Needs the whole FAT resident; only done once per mount
+static int fat12_build_free_map(void) {
+    unsigned int end = disk_geom.cluster_count + 2;
+
+    if (free_map_valid) return 0;
+    if (end > FAT12_MAX_ENTRIES || fat12_read_fat()) return -1;
+
+    for (unsigned int i = 0; i < sizeof(free_map); i++) free_map[i] = 0;
+    free_count = 0;
+    for (unsigned int c = 2; c < end; c++) {
+        if (fat12_get_next_cluster(c) == 0) {
+            free_map[c >> 3] |= 1u << (c & 7);
+            free_count++;
+        }
+    }
+    free_map_valid = 1;
+    return 0;
+}
+
+static inline int fat12_is_free(unsigned int cluster) {
+    return free_map[cluster >> 3] & (1u << (cluster & 7));
+}
+
+// Free clusters from `start`, at most `want`
+static unsigned int fat12_run_length(unsigned int start, unsigned int want) {
+    unsigned int end = disk_geom.cluster_count + 2;
+    unsigned int n = 0;
+    while (n < want && start + n < end && fat12_is_free(start + n)) n++;
+    return n;
+}
+
+// A free run for `want` more clusters of a file whose chain ends at `last`:
+// right after `last` when that is free, so the file stays in one piece;
+// otherwise the first run of at least FAT12_RUN_GOAL (or `want`, if more),
+// so that small appends to a new file do not fill single-cluster holes,
+// else the longest run. Returns the first cluster (0 when the disk is
+// full) and the run length, at most `want`, through *len.
+#define FAT12_RUN_GOAL 8
+
+static unsigned short fat12_find_run(unsigned short last, unsigned int want, unsigned int *len) {
+    unsigned int end = disk_geom.cluster_count + 2;
+    unsigned int goal = want > FAT12_RUN_GOAL ? want : FAT12_RUN_GOAL;
+    unsigned short best = 0;
+    unsigned int best_len = 0;
+
+    if (last >= 2 && (*len = fat12_run_length(last + 1, want)) > 0) return last + 1;
+
+    for (unsigned int c = 2; c < end && best_len < goal; ) {
+        if (!free_map[c >> 3]) {             // Eight clusters in use
+            c = (c | 7) + 1;
+            continue;
+        }
+        unsigned int n = fat12_run_length(c, goal);
+        if (n > best_len) {
+            best = c;
+            best_len = n;
+        }
+        c += n ? n : 1;
+    }
+    *len = best_len < want ? best_len : want;
+    return best;
+}
+
+// Add `count` clusters to the chain ending at `last` (0 for an empty
+// file); the first new one goes to *first
+static int fat12_grow(unsigned short last, unsigned int count, unsigned short *first) {
+    *first = 0;
+    if (count > free_count) return -1;
+
+    while (count) {
+        unsigned int n;
+        unsigned short c = fat12_find_run(last, count, &n);
+        if (!c) return -1;
+
+        for (unsigned int i = 0; i < n; i++, c++) {
+            if (fat12_set_next_cluster(c, 0xFFF)) return -1;
+            if (last && fat12_set_next_cluster(last, c)) return -1;
+            if (!*first) *first = c;
+            last = c;
+        }
+        count -= n;
+    }
+    return 0;
+}
+
+// Release the chain from `cluster` on
+static int fat12_free_chain(unsigned short cluster) {
+    while (cluster >= 2 && cluster - 2 < disk_geom.cluster_count) {
+        unsigned short next = fat12_get_next_cluster(cluster);
+        if (fat12_set_next_cluster(cluster, 0)) return -1;
+        cluster = next;
+    }
+    return 0;
+}
+
+// Cut the chain of `entry` after `keep` clusters, releasing the rest; the
+// last cluster kept goes to *last (0 when none is)
+static int fat12_cut_chain(struct fat12_dir_entry *entry, uint32_t keep, unsigned short *last) {
+    *last = 0;
+    if (keep == 0) {
+        if (fat12_free_chain(entry->start_cluster)) return -1;
+        entry->start_cluster = 0;
+        return 0;
+    }
+
+    if (!(*last = fat12_chain_at(entry->start_cluster, keep - 1))) return -1;
+    unsigned short next = fat12_get_next_cluster(*last);
+    if (next >= 0xFF8) return 0;             // Already ends here
+    return fat12_set_next_cluster(*last, 0xFFF) || fat12_free_chain(next) ? -1 : 0;
+}
+
+static uint32_t fat12_clusters_for(uint32_t size) {
+    return udiv32_16(size + disk_geom.cluster_bytes - 1, disk_geom.cluster_bytes, 0);
+}
+
+// The entry was changed: stamp it and mark its directory sector
+static void fat12_touch_entry(struct fat12_dir_entry *entry) {
+    uint16_t date, time;
+
+    clock_dos_time(&date, &time);
+    entry->mdate = date;
+    entry->mtime = time;
+    entry->adate = date;
+    entry->attr |= 0x20;                     // Archive
+    root_dirty |= 1u << (fat12_root_slot(entry) >> 4);
+}
+
+// 8.3 names only: 1-8 characters, an optional extension of up to 3, none
+// of the characters DOS reserves
+static int fat12_valid_name(const char *name) {
+    static const char reserved[] = "\"*+,/:;<=>?[\\]|";
+    unsigned int base = 0, ext = 0, dots = 0;
+
+    for (; *name; name++) {
+        unsigned char c = *name;
+        if (c == '.') {
+            if (dots++) return 0;
+            continue;
+        }
+        if (c <= ' ') return 0;
+        for (const char *r = reserved; *r; r++) {
+            if (c == (unsigned char)*r) return 0;
+        }
+        if (dots) ext++;
+        else base++;
+    }
+    return base >= 1 && base <= 8 && ext <= 3;
+}
+
+// New empty file in the root directory, in the first deleted or unused
+// slot. Returns 0 if the name exists or is invalid, or the directory is
+// full.
+struct fat12_dir_entry *fat12_create(const char *filename) {
+    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+    struct fat12_dir_entry *entry = 0;
+    char formatted[12];
+    unsigned int i;
+
+    if (!fat12_initialized || !fat12_valid_name(filename) || fat12_find_file(filename)) return 0;
+
+    for (i = 0; i < boot_sector.root_entries; i++) {
+        if ((i & 15) == 0 && fat12_load_root_sector(i >> 4)) return 0;
+        if (entries[i].name[0] == 0x00 || entries[i].name[0] == 0xE5) {
+            entry = &entries[i];
+            break;
+        }
+    }
+    if (!entry) return 0;
+
+    format_filename(filename, formatted);
+    if ((unsigned char)formatted[0] == 0xE5) formatted[0] = 0x05;
+
+    unsigned char *raw = (unsigned char *)entry;
+    for (unsigned int j = 0; j < sizeof(*entry); j++) raw[j] = 0;
+    for (unsigned int j = 0; j < 11; j++) raw[j] = formatted[j];
+    fat12_touch_entry(entry);
+    entry->ctime = entry->mtime;
+    entry->cdate = entry->mdate;
+
+    // Slots the index has already passed are not scanned again, and once
+    // it has seen the end of the directory it scans nothing more
+    if (i < root_index_scanned || root_index_complete) fat12_index_insert(i);
+    return entry;
+}
+
+// Append `len` bytes from `src`. New clusters continue the file's last run
+// when they can. Returns the bytes written, -1 if nothing could be.
+long fat12_append(struct fat12_dir_entry *entry, farptr_t src, unsigned int len) {
+    struct fat12_file f;
+    unsigned int done = 0;
+
+    if (!fat12_initialized || (entry->attr & 0x19) || fat12_root_slot(entry) < 0 ||
+        fat12_build_free_map()) {
+        return -1;
+    }
+    if (!len) return 0;
+
+    uint32_t size = entry->size;
+    uint32_t have = fat12_clusters_for(size);
+    uint32_t need = fat12_clusters_for(size + len);
+
+    if (need > have) {
+        unsigned short last, first;
+
+        // Clusters past the size (an interrupted append) are let go first
+        if (fat12_cut_chain(entry, have, &last) || fat12_grow(last, need - have, &first)) {
+            return -1;
+        }
+        if (!have) entry->start_cluster = first;
+        fat12_extent_cache_flush();
+    }
+
+    f.start_cluster = entry->start_cluster;
+    f.size = size + len;
+    if (fat12_seek(&f, size)) return -1;
+
+    // Whole sectors go straight from `src`; a partial one is merged with
+    // what the file already has in it
+    src = FAR_NORM(src);
+    while (done < len) {
+        unsigned int want = len - done;
+        unsigned int offset = (uint16_t)f.pos & 511;
+        unsigned int lba, sectors, bytes;
+
+        if (fat12_locate(&f, &lba, &sectors)) break;
+
+        if (offset == 0 && want >= 512) {
+            if (sectors > (want >> 9)) sectors = want >> 9;
+            if (disk_write_sectors(lba, sectors, src)) break;
+            bytes = sectors << 9;
+            src = FAR_ADD_SECTORS(src, sectors);
+        } else {
+            if (offset) {
+                if (disk_read_sectors(lba, 1, near_to_far(stream_buf[0]))) break;
+            } else {
+                for (unsigned int i = 0; i < 512; i++) stream_buf[0][i] = 0;
+            }
+            bytes = 512 - offset;
+            if (bytes > want) bytes = want;
+            far_memcpy(near_to_far(stream_buf[0] + offset), src, bytes);
+            if (disk_write_sectors(lba, 1, near_to_far(stream_buf[0]))) break;
+            src = FAR_ADD(src, bytes);
+        }
+
+        fat12_advance(&f, bytes);
+        done += bytes;
+    }
+
+    if (done) {
+        entry->size = size + done;
+        fat12_touch_entry(entry);
+    }
+    return done ? (long)done : -1;
+}
+
+// Append through an open file, which keeps reading where it was
+long fat12_write(struct fat12_file *f, farptr_t src, unsigned int len) {
+    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+
+    if (f->dir_slot >= boot_sector.root_entries) return -1;
+    struct fat12_dir_entry *entry = &entries[f->dir_slot];
+    if ((unsigned char)entry->name[0] == 0xE5) return -1;   // Deleted meanwhile
+
+    long n = fat12_append(entry, src, len);
+    if (n < 0) return -1;
+
+    f->start_cluster = entry->start_cluster;
+    f->size = entry->size;
+    return fat12_seek(f, f->pos) ? -1 : n;
+}
+
+// Shorten to `size` bytes, releasing the clusters past it
+int fat12_truncate(struct fat12_dir_entry *entry, uint32_t size) {
+    if (!fat12_initialized || (entry->attr & 0x19) || fat12_root_slot(entry) < 0 ||
+        size > entry->size || fat12_build_free_map()) {
+        return -1;
+    }
+
+    unsigned short last;
+    if (fat12_cut_chain(entry, fat12_clusters_for(size), &last)) return -1;
+
+    entry->size = size;
+    fat12_touch_entry(entry);
+    fat12_extent_cache_flush();
+    return 0;
+}
+
+int fat12_delete(const char *filename) {
+    struct fat12_dir_entry *entry = fat12_find_file(filename);
+
+    if (!entry || (entry->attr & 0x19) || fat12_root_slot(entry) < 0 ||
+        fat12_build_free_map()) {
+        return -1;
+    }
+    if (fat12_free_chain(entry->start_cluster)) return -1;
+
+    entry->name[0] = 0xE5;
+    root_dirty |= 1u << (fat12_root_slot(entry) >> 4);
+
+    // Open addressing cannot drop a key in place; the index is rebuilt from
+    // the resident sectors on the next lookup
+    fat12_index_reset();
+    fat12_extent_cache_flush();
+    return 0;
+}
+
+// Write the dirty FAT sectors to every FAT copy and the dirty directory
+// sectors, then have the platform flush its write-back cache. Sectors that
+// fail stay dirty.
+int fat12_sync(void) {
+    int result = 0;
+
+    if (!fat12_initialized) return 0;
+
+    for (unsigned int n = 0; n < boot_sector.sectors_per_fat; n++) {
+        if (!(fat_dirty & (1u << n))) continue;
+
+        int ok = 1;
+        for (unsigned int k = 0; k < boot_sector.num_fats; k++) {
+            unsigned int lba = disk_geom.fat_lba + k * boot_sector.sectors_per_fat + n;
+            if (disk_write_sectors(lba, 1, fat_sectors[n])) ok = 0;
+        }
+        if (ok) fat_dirty &= ~(1u << n);
+        else result = -1;
+    }
+
+    // Runs of dirty directory sectors are consecutive in the buffer
+    for (unsigned int n = 0; n < disk_geom.root_sectors; ) {
+        unsigned int run = 0;
+        while (n + run < disk_geom.root_sectors && (root_dirty & (1u << (n + run)))) run++;
+        if (!run) {
+            n++;
+            continue;
+        }
+        if (disk_write_sectors(disk_geom.root_lba + n, run, near_to_far(&root_dir_buffer[n * 512]))) {
+            result = -1;
+        } else {
+            root_dirty &= ~(((1u << run) - 1) << n);
+        }
+        n += run;
+    }
+
+    if (disk_sync()) result = -1;
+    return result;
+}
+
+// Sync, then forget the volume. Stays mounted if the sync fails.
+int fat12_unmount(void) {
+    if (fat12_sync()) return -1;
+
+    fat12_release_fat();
+    root_resident = 0;
+    free_map_valid = 0;
+    fat12_index_reset();
+    fat12_dentry_flush();
+    fat12_extent_cache_flush();
+    fat12_initialized = 0;
+    return 0;
+}
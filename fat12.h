@@ -0,0 +1,143 @@
+// FAT12 driver interface. fat12.c only touches the disk, console and clock
+// through the hooks at the bottom, which kernel.c implements on the BIOS
+// and tools/fat12_host.c implements over an image file.
+#ifndef FAT12_H
+#define FAT12_H
+
+#include <stdint.h>
+#include "runtime.h"
+
+#define FLOPPY_DRIVE_A 0x00
+
+#define FAT12_MAX_FAT_SECTORS  9
+#define FAT12_MAX_ROOT_SECTORS 15
+
+#define STREAM_CHUNK_BYTES 1024
+
+struct __attribute__((packed)) fat12_boot_sector {
+    unsigned char  jump[3];
+    unsigned char  oem[8];
+    uint16_t       bytes_per_sector;
+    uint8_t        sectors_per_cluster;
+    uint16_t       reserved_sectors;
+    uint8_t        num_fats;
+    uint16_t       root_entries;
+    uint16_t       total_sectors_short;
+    uint8_t        media_descriptor;
+    uint16_t       sectors_per_fat;
+    uint16_t       sectors_per_track;
+    uint16_t       num_heads;
+    uint32_t       hidden_sectors;
+    uint32_t       total_sectors_long;
+};
+
+struct __attribute__((packed)) fat12_dir_entry {
+    unsigned char name[8];           // Offset 0-7: Filename (8 bytes)
+    unsigned char ext[3];            // Offset 8-10: Extension (3 bytes)
+    uint8_t       attr;              // Offset 11: Attributes
+    uint8_t       reserved;          // Offset 12: Reserved (Windows NT)
+    uint8_t       ctime_ms;          // Offset 13: Creation time, fine resolution
+    uint16_t      ctime;             // Offset 14-15: Creation time
+    uint16_t      cdate;             // Offset 16-17: Creation date
+    uint16_t      adate;             // Offset 18-19: Last access date
+    uint16_t      cluster_high;      // Offset 20-21: High 16 bits of cluster (FAT32, 0 for FAT12)
+    uint16_t      mtime;             // Offset 22-23: Last modification time
+    uint16_t      mdate;             // Offset 24-25: Last modification date
+    uint16_t      start_cluster;     // Offset 26-27: Starting cluster (LOW 16 bits)
+    uint32_t      size;              // Offset 28-31: File size in bytes
+};
+
+// Standard floppy formats the BPB is checked against
+struct media_profile {
+    const char     *name;
+    unsigned short total_sectors;
+    unsigned char  sectors_per_track;
+    unsigned char  num_heads;
+    unsigned char  media_descriptor;
+};
+
+// Volume layout derived once from the BPB at mount
+struct disk_geometry {
+    unsigned char  drive;
+    unsigned short sectors_per_track;
+    unsigned short num_heads;
+    unsigned short sectors_per_cylinder;
+    unsigned short cylinders;
+    unsigned short total_sectors;
+    unsigned short fat_lba;          // First sector of the first FAT
+    unsigned short root_lba;         // First root directory sector
+    unsigned short root_sectors;
+    unsigned short data_lba;         // First sector of cluster 2
+    unsigned short cluster_sectors;
+    unsigned short cluster_bytes;
+    unsigned short cluster_count;    // Data clusters (numbered from 2)
+    const struct media_profile *profile;  // 0 for non-standard media
+};
+
+// Position on disk; advanced without division
+struct chs_cursor {
+    unsigned short cyl;
+    unsigned char  head;
+    unsigned char  sector;           // 1-based
+};
+
+struct fat12_file {
+    unsigned short start_cluster;
+    unsigned short cluster;          // Cluster holding `pos`
+    uint32_t       size;
+    uint32_t       pos;              // Next byte to read
+    unsigned short dir_slot;         // Root directory entry, 0xFFFF if unknown
+};
+
+extern struct fat12_boot_sector boot_sector;
+extern struct disk_geometry disk_geom;
+extern unsigned char fat12_initialized;
+extern unsigned char fat12_lazy;                // FAT and root sectors read on first use
+extern unsigned char stream_buf[2][STREAM_CHUNK_BYTES];
+
+void chs_seek(const struct disk_geometry *geom, struct chs_cursor *pos, unsigned int lba);
+void chs_advance(const struct disk_geometry *geom, struct chs_cursor *pos, unsigned int n);
+
+int fat12_init(void);
+int fat12_list_files(const char *path);
+struct fat12_dir_entry *fat12_dir_next(unsigned short dir, unsigned int *slot);
+struct fat12_dir_entry *fat12_find_file(const char *path);
+unsigned short fat12_get_next_cluster(unsigned short cluster);
+long fat12_read_file(const struct fat12_dir_entry *file, farptr_t dst, uint32_t max_size);
+void fat12_index_stat(const char *name);
+void fat12_frag(const char *filename);
+int fat12_prefetch_step(void);
+unsigned int fat12_cluster_lba(unsigned short cluster);
+
+int fat12_open(const struct fat12_dir_entry *entry, struct fat12_file *f);
+void fat12_close(struct fat12_file *f);
+int fat12_seek(struct fat12_file *f, uint32_t offset);
+long fat12_read_chunk(struct fat12_file *f, void *buf, unsigned int len, unsigned int *start);
+long fat12_read_far(struct fat12_file *f, farptr_t dst, unsigned int len);
+int fat12_stream_out(const struct fat12_dir_entry *entry, uint32_t offset, uint32_t length);
+
+struct fat12_dir_entry *fat12_create(const char *filename);
+long fat12_append(struct fat12_dir_entry *entry, farptr_t src, unsigned int len);
+long fat12_write(struct fat12_file *f, farptr_t src, unsigned int len);
+int fat12_truncate(struct fat12_dir_entry *entry, uint32_t size);
+int fat12_delete(const char *filename);
+int fat12_sync(void);
+int fat12_unmount(void);
+
+// Platform hooks
+int disk_read_boot_sector(unsigned char drive, void *buf);
+int disk_read_sectors(unsigned int lba, unsigned int count, farptr_t buffer);
+int disk_write_sectors(unsigned int lba, unsigned int count, farptr_t buffer);  // May be cached
+int disk_sync(void);                            // Write back anything cached
+farptr_t disk_sector_alloc(void);               // 512-byte buffer, 0 when out of memory
+void disk_sector_free(farptr_t buf);
+void disk_configure(const struct disk_geometry *geom);
+uint32_t timer_us(void);
+void clock_dos_time(uint16_t *date, uint16_t *time);   // For directory entries
+void console_write(const char *buf, unsigned int len);
+void console_putc(char c);
+void console_puts(const char *s);
+void console_newline(void);
+void console_putdec(uint32_t val);
+
+#endif
@@ -0,0 +1,138 @@
+; Interrupt entry stubs for 16-bit NASM
+;
+; Each stub saves the interrupted context, points DS/ES at the kernel
+; segment (the kernel runs with CS == DS), calls a C handler
+; `void handler(void)`, acknowledges the PIC and returns with IRET.
+;
+; SS:SP is left as interrupted, so handlers may run on an app's stack:
+; they must not hand out pointers to their locals (near pointers are
+; DS-relative).
+
+BITS 16
+
+; IRQ_STUB name, c_handler, irq
+%macro IRQ_STUB 3
+global %1
+extern %2
+%1:
+    pusha
+    push ds
+    push es
+    mov  ax, cs
+    mov  ds, ax
+    mov  es, ax
+    cld
+    call %2
+    mov  al, 0x20       ; Non-specific EOI
+%if %3 >= 8
+    out  0xA0, al
+%endif
+    out  0x20, al
+    pop  es
+    pop  ds
+    popa
+    iret
+%endmacro
+
+section .text
+
+IRQ_STUB isr_kbd, kbd_irq, 1
+IRQ_STUB isr_com1, com1_irq, 4
+
+; Kernel service call entry (software interrupt). The caller's registers
+; are copied into `syscall_frame` (DI SI BP SP BX DX CX AX ES DS IP CS
+; FLAGS, lowest address first) and the C dispatcher
+; `void syscall_dispatch(struct syscall_regs *)` runs on a kernel stack,
+; so it may hand out near pointers. Whatever it leaves in the frame,
+; including FLAGS, is returned to the caller. Not reentrant.
+
+SYSCALL_FRAME_WORDS equ 13
+
+section .bss
+global syscall_frame
+syscall_frame   resw SYSCALL_FRAME_WORDS
+syscall_ss      resw 1
+syscall_sp      resw 1
+syscall_stack   resb 1024
+syscall_stack_top:
+
+section .text
+global isr_syscall
+extern syscall_dispatch
+
+isr_syscall:
+    push ds
+    push es
+    pusha
+    mov  ax, cs
+    mov  ds, ax
+    mov  es, ax
+    mov  [syscall_ss], ss
+    mov  [syscall_sp], sp
+
+    ; Copy the frame in from the caller's stack
+    mov  di, syscall_frame
+    mov  si, sp
+    mov  cx, SYSCALL_FRAME_WORDS
+    push ss
+    pop  ds
+    cld
+    rep  movsw
+    mov  ds, ax
+
+    mov  ss, ax         ; Interrupts are still off from INT
+    mov  sp, syscall_stack_top
+    sti
+    push word syscall_frame
+    call syscall_dispatch
+    add  sp, 2
+    cli
+
+    ; Copy it back and return on the caller's stack
+    mov  ss, [syscall_ss]
+    mov  sp, [syscall_sp]
+    mov  es, [syscall_ss]
+    mov  di, sp
+    mov  si, syscall_frame
+    mov  cx, SYSCALL_FRAME_WORDS
+    cld
+    rep  movsw
+    popa
+    pop  es
+    pop  ds
+    iret
+
+; PIT IRQ0. The C handler `unsigned int timer_irq(unsigned short ip,
+; unsigned short cs)` gets the interrupted address, for the profiler, and
+; returns non-zero when the BIOS tick is due; the BIOS handler then runs
+; with the original registers and sends the EOI itself.
+
+global isr_timer
+extern timer_irq
+extern timer_old_vector
+
+isr_timer:
+    pusha
+    push ds
+    push es
+    mov  ax, cs
+    mov  ds, ax
+    mov  es, ax
+    cld
+    mov  bp, sp         ; ES DS, then PUSHA's 8 words, then IP CS FLAGS
+    push word [bp+22]   ; CS, read through SS
+    push word [bp+20]   ; IP
+    call timer_irq
+    add  sp, 4
+    test ax, ax         ; POP and POPA leave the flags alone
+    pop  es
+    pop  ds
+    popa
+    jnz  .chain
+    push ax
+    mov  al, 0x20       ; Non-specific EOI
+    out  0x20, al
+    pop  ax
+    iret
+.chain:
+    jmp  far [cs:timer_old_vector]
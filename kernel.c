@@ -1,49 +1,28 @@
 #include <stdint.h>
+#include "runtime.h"
+#include "fat12.h"
+#include "mem.h"
+#include "lz.h"
 
 #define COM1_BASE 0x3F8
 #define COM1_DATA (COM1_BASE + 0)
 #define COM1_IER  (COM1_BASE + 1)
+#define COM1_IIR  (COM1_BASE + 2)
+#define COM1_FCR  (COM1_BASE + 2)
 #define COM1_LCR  (COM1_BASE + 3)
+#define COM1_MCR  (COM1_BASE + 4)
 #define COM1_LSR  (COM1_BASE + 5)
+#define COM1_MSR  (COM1_BASE + 6)
+#define COM1_IRQ  4
+#define COM1_VECTOR 0x0C
 
-#define FLOPPY_DRIVE_A 0x00
-
-#define APP_LOAD_ADDR 0x2000
-#define APP_MAX_SIZE  4096
-
-struct __attribute__((packed)) fat12_boot_sector {
-    unsigned char  jump[3];
-    unsigned char  oem[8];
-    uint16_t       bytes_per_sector;
-    uint8_t        sectors_per_cluster;
-    uint16_t       reserved_sectors;
-    uint8_t        num_fats;
-    uint16_t       root_entries;
-    uint16_t       total_sectors_short;
-    uint8_t        media_descriptor;
-    uint16_t       sectors_per_fat;
-    uint16_t       sectors_per_track;
-    uint16_t       num_heads;
-    uint32_t       hidden_sectors;
-    uint32_t       total_sectors_long;
-};
-
-struct __attribute__((packed)) fat12_dir_entry {
-    unsigned char name[8];           // Offset 0-7: Filename (8 bytes)
-    unsigned char ext[3];            // Offset 8-10: Extension (3 bytes)
-    uint8_t       attr;              // Offset 11: Attributes
-    uint8_t       reserved;          // Offset 12: Reserved (Windows NT)
-    uint8_t       ctime_ms;          // Offset 13: Creation time, fine resolution
-    uint16_t      ctime;             // Offset 14-15: Creation time
-    uint16_t      cdate;             // Offset 16-17: Creation date
-    uint16_t      adate;             // Offset 18-19: Last access date
-    uint16_t      cluster_high;      // Offset 20-21: High 16 bits of cluster (FAT32, 0 for FAT12)
-    uint16_t      mtime;             // Offset 22-23: Last modification time
-    uint16_t      mdate;             // Offset 24-25: Last modification date
-    uint16_t      start_cluster;     // Offset 26-27: Starting cluster (LOW 16 bits)
-    uint32_t      size;              // Offset 28-31: File size in bytes
-};
+// Ring buffer sizes, must be powers of two
+#define COM_RX_BUF_SIZE 256
+#define COM_TX_BUF_SIZE 512
 
+// Apps are loaded into far memory from the shell's scratch arena
+#define APP_LEGACY_ORG 0x2000        // Flat binaries expect to run at DS:0x2000
+#define APP_MAGIC      0x5842        // "BX"
 
 static inline void outb(unsigned short port, unsigned char val) {
     __asm__ __volatile__("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -55,6 +34,36 @@ static inline unsigned char inb(unsigned short port) {
     return ret;
 }
 
+// Install `handler` (in the kernel code segment) as interrupt `vec`,
+// returning the previous vector through `old` if non-null
+static void set_int_vector(unsigned char vec, void (*handler)(void), farptr_t *old) {
+    farptr_t entry = MK_FAR(get_cs(), (unsigned short)handler);
+    farptr_t slot = MK_FAR(0, vec * 4);
+
+    __asm__ __volatile__("cli");
+    if (old) far_memcpy(near_to_far(old), slot, sizeof(farptr_t));
+    far_memcpy(slot, near_to_far(&entry), sizeof(farptr_t));
+    __asm__ __volatile__("sti");
+}
+
+static void restore_int_vector(unsigned char vec, farptr_t old) {
+    __asm__ __volatile__("cli");
+    far_memcpy(MK_FAR(0, vec * 4), near_to_far(&old), sizeof(farptr_t));
+    __asm__ __volatile__("sti");
+}
+
+// Master PIC interrupt mask (IRQ 0-7)
+#define PIC1_DATA 0x21
+
+static void pic_unmask(unsigned char irq) {
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+}
+
+static void pic_mask(unsigned char irq) {
+    outb(PIC1_DATA, inb(PIC1_DATA) | (1 << irq));
+}
+
+
 int str_to_int(const char *s) {
     int val = 0;
     while (*s >= '0' && *s <= '9') {
@@ -64,17 +73,29 @@ int str_to_int(const char *s) {
     return val;
 }
 
-unsigned int div32_16(unsigned long n, unsigned int d) {
-    unsigned int q = 0;
-    while (n >= d) {
-        n -= d;
-        q++;
+unsigned int strlen(const char *s) {
+    unsigned int n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static uint32_t str_to_u32(const char *s) {
+    uint32_t val = 0;
+    while (*s >= '0' && *s <= '9') {
+        val = umul32_16(val, 10) + (*s - '0');
+        s++;
     }
-    return q;
+    return val;
 }
 
+#define PIT_FREQ 1193182UL
+
 void speaker_on(unsigned int freq) {
-    unsigned int divisor = div32_16(1193180UL, freq);
+    if (freq == 0) return;
+
+    // Frequencies below ~19 Hz don't fit the 16-bit divisor; 0 means 65536
+    uint32_t q = udiv32_16(PIT_FREQ, freq, 0);
+    unsigned int divisor = (q >> 16) ? 0 : (unsigned int)q;
 
     // set PIT channel 2, mode 3
     outb(0x43, 0xB6);
@@ -93,622 +114,2863 @@ void speaker_off(void) {
     outb(0x61, tmp);
 }
 
-static void com1_init(void) {
-    outb(COM1_IER, 0x00);        // Disable interrupts
-    outb(COM1_LCR, 0x80);        // Enable DLAB
-    outb(COM1_BASE + 0, 0x0C);
-    outb(COM1_BASE + 1, 0x00);   // DLM = 0
-    outb(COM1_LCR, 0x03);        // 8N1, disable DLAB
-    outb(COM1_BASE + 2, 0xC7);   // Enable FIFO, clear
-    outb(COM1_IER, 0x0B);
-}
+// Kernel clock: PIT channel 0 at 1 kHz. The BIOS handler is chained every
+// 65536 input clocks, so its 18.2 Hz tick (and the floppy motor timeout)
+// keeps running at the usual rate.
+#define TIMER_HZ      1000
+#define TIMER_DIVISOR 1193           // PIT_FREQ / TIMER_HZ
+#define TIMER_VECTOR  0x08
+#define TIMER_IRQ     0
+
+extern void isr_timer(void);
+
+static volatile uint32_t timer_ticks;
+static unsigned short timer_bios_acc;
+static unsigned char timer_installed;
+farptr_t timer_old_vector;           // Jumped through by isr_timer
+
+static unsigned char prof_running;
+static unsigned short prof_interval, prof_countdown;
+static void prof_sample(unsigned short ip, unsigned short cs);
+
+// `ip` and `cs` are where the tick interrupted
+unsigned int timer_irq(unsigned short ip, unsigned short cs) {
+    timer_ticks++;
+    if (prof_running && --prof_countdown == 0) {
+        prof_countdown = prof_interval;
+        prof_sample(ip, cs);
+    }
+    unsigned short before = timer_bios_acc;
+    timer_bios_acc += TIMER_DIVISOR;
+    return timer_bios_acc < before;  // Carried past 65536: BIOS tick due
+}
+
+// Channel 0, low/high byte, `mode` 2 (rate generator) or 3 (square wave)
+static void timer_program(unsigned char mode, unsigned short divisor) {
+    __asm__ __volatile__("cli");
+    outb(0x43, 0x30 | (mode << 1));
+    outb(0x40, divisor & 0xFF);
+    outb(0x40, divisor >> 8);
+    __asm__ __volatile__("sti");
+}
+
+static void timer_init(void) {
+    if (timer_installed) return;
+    timer_bios_acc = 0;
+    set_int_vector(TIMER_VECTOR, isr_timer, &timer_old_vector);
+    timer_program(2, TIMER_DIVISOR);
+    pic_unmask(TIMER_IRQ);
+    timer_installed = 1;
+}
+
+// Back to the BIOS rate and handler, e.g. before a reboot
+static void timer_shutdown(void) {
+    if (!timer_installed) return;
+    timer_program(3, 0);
+    restore_int_vector(TIMER_VECTOR, timer_old_vector);
+    timer_installed = 0;
+}
+
+// Microseconds since timer_init, from the tick count plus the latched
+// counter; wraps after about 71 minutes
+uint32_t timer_us(void) {
+    uint32_t ticks;
+    unsigned short count;
+
+    __asm__ __volatile__("cli");
+    ticks = timer_ticks;
+    outb(0x43, 0x00);                // Latch channel 0
+    count = inb(0x40);
+    count |= inb(0x40) << 8;
+    outb(0x20, 0x0A);                // Read the PIC IRR
+    if ((inb(0x20) & 1) && count > TIMER_DIVISOR / 2) ticks++;  // Reloaded, IRQ not yet taken
+    __asm__ __volatile__("sti");
+
+    if (count > TIMER_DIVISOR) count = TIMER_DIVISOR;
+    return umul32_16(ticks, 1000) +
+           udiv32_16(umul16x16(TIMER_DIVISOR - count, 1000), TIMER_DIVISOR, 0);
+}
+
+// Kernel-wide counters, shown by 'stats'
+struct kstats {
+    uint32_t sectors_read;           // Requested through disk_read_sectors
+    uint32_t disk_sectors;           // Transferred from the drive
+    uint32_t sectors_written;        // Requested through disk_write_sectors
+    uint32_t disk_writes;            // Write requests to the drive
+    uint32_t disk_sectors_written;   // ...and the sectors they carried
+    uint32_t ramdisk_sectors;        // Served from the RAM disk
+    uint32_t bytes_printed;          // Console output
+};
+
+static struct kstats kstats;
+
+// Kept by bios_read_sectors and bios_write_sectors
+extern uint32_t bios_disk_calls;
+extern uint32_t bios_disk_retries;
+
+// Interrupt-driven 16550 driver for COM1. The ISR moves bytes between the
+// UART FIFO and two rings; com_write/com_read never wait on the line.
+
+static volatile unsigned char com_rx_buf[COM_RX_BUF_SIZE];
+static volatile unsigned char com_tx_buf[COM_TX_BUF_SIZE];
+static volatile unsigned short com_rx_head, com_rx_tail;
+static volatile unsigned short com_tx_head, com_tx_tail;
+static volatile unsigned char com_ier;
+
+static volatile uint32_t com_rx_overruns;    // Lost in the UART (LSR OE)
+static volatile uint32_t com_rx_dropped;     // RX ring full
+static uint32_t com_tx_dropped;              // Rejected by com_write, TX ring full
+
+static unsigned char com_installed;
+static farptr_t com_old_vector;
+static uint32_t com_baud;
+static unsigned char com_fifo_trigger;
+
+extern void isr_com1(void);
+
+// Called from isr_com1 with interrupts disabled
+void com1_irq(void) {
+    unsigned char iir;
+
+    while (!((iir = inb(COM1_IIR)) & 0x01)) {
+        switch (iir & 0x0E) {
+        case 0x06:                              // Line status
+            if (inb(COM1_LSR) & 0x02) com_rx_overruns++;
+            break;
+        case 0x04:                              // RX data available
+        case 0x0C: {                            // RX FIFO timeout
+            unsigned char lsr;
+            while ((lsr = inb(COM1_LSR)) & 0x01) {
+                unsigned char c = inb(COM1_DATA);
+                unsigned short next = (com_rx_head + 1) & (COM_RX_BUF_SIZE - 1);
+                if (lsr & 0x02) com_rx_overruns++;
+                if (next == com_rx_tail) {
+                    com_rx_dropped++;
+                } else {
+                    com_rx_buf[com_rx_head] = c;
+                    com_rx_head = next;
+                }
+            }
+            break;
+        }
+        case 0x02: {                            // THR empty: refill the FIFO
+            unsigned int n = 16;
+            while (n-- && com_tx_tail != com_tx_head) {
+                outb(COM1_DATA, com_tx_buf[com_tx_tail]);
+                com_tx_tail = (com_tx_tail + 1) & (COM_TX_BUF_SIZE - 1);
+            }
+            if (com_tx_tail == com_tx_head) {
+                com_ier &= ~0x02;               // Nothing left, stop THRE interrupts
+                outb(COM1_IER, com_ier);
+            }
+            break;
+        }
+        default:                                // Modem status
+            inb(COM1_MSR);
+            break;
+        }
+    }
+}
+
+// Program COM1 for `baud` (a divisor of 115200) and a FIFO RX trigger level
+// of 1, 4, 8 or 14 bytes. Returns -1 on an unsupported setting.
+static int com1_init(uint32_t baud, unsigned char fifo_trigger) {
+    uint32_t rem;
+    if (baud == 0 || baud > 115200) return -1;
+    uint32_t divisor = udiv32(115200UL, baud, &rem);
+    if (rem) return -1;
+
+    unsigned char fcr;
+    switch (fifo_trigger) {
+    case 1:  fcr = 0x00; break;
+    case 4:  fcr = 0x40; break;
+    case 8:  fcr = 0x80; break;
+    case 14: fcr = 0xC0; break;
+    default: return -1;
+    }
+
+    pic_mask(COM1_IRQ);
+    outb(COM1_IER, 0x00);                  // Disable interrupts
+    outb(COM1_LCR, 0x80);                  // Enable DLAB
+    outb(COM1_BASE + 0, divisor & 0xFF);   // DLL
+    outb(COM1_BASE + 1, divisor >> 8);     // DLM
+    outb(COM1_LCR, 0x03);                  // 8N1, disable DLAB
+    outb(COM1_FCR, fcr | 0x07);            // Enable FIFO, clear both
+    outb(COM1_MCR, 0x0B);                  // DTR, RTS, OUT2 (IRQ gate)
+
+    // Drain anything left over so the first interrupt edge is clean
+    while (inb(COM1_LSR) & 0x01) inb(COM1_DATA);
+    inb(COM1_IIR);
+    inb(COM1_MSR);
+
+    if (!com_installed) {
+        set_int_vector(COM1_VECTOR, isr_com1, &com_old_vector);
+        com_installed = 1;
+    }
+
+    com_rx_head = com_rx_tail = 0;
+    com_tx_head = com_tx_tail = 0;
+    com_baud = baud;
+    com_fifo_trigger = fifo_trigger;
+
+    com_ier = 0x05;                        // RX data + line status
+    outb(COM1_IER, com_ier);
+    pic_unmask(COM1_IRQ);
+    return 0;
+}
+
+// Queue up to `len` bytes for transmission. Returns how many were taken.
+static unsigned int com_write(const void *buf, unsigned int len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    unsigned int n = 0;
+
+    if (!com_installed) return 0;
+
+    while (n < len) {
+        unsigned short next = (com_tx_head + 1) & (COM_TX_BUF_SIZE - 1);
+        if (next == com_tx_tail) break;
+        com_tx_buf[com_tx_head] = p[n++];
+        com_tx_head = next;
+    }
+    com_tx_dropped += len - n;
+
+    if (n && !(com_ier & 0x02)) {
+        // Re-arming THRE raises an interrupt at once if the THR is empty
+        __asm__ __volatile__("cli");
+        com_ier |= 0x02;
+        outb(COM1_IER, com_ier);
+        __asm__ __volatile__("sti");
+    }
+    return n;
+}
+
+// IF in FLAGS: clear in interrupt handlers and between cli and sti
+static inline int interrupts_enabled(void) {
+    unsigned short flags;
+    __asm__ __volatile__("pushf\n\tpop %0" : "=r"(flags));
+    return flags & 0x200;
+}
+
+// Queue all of `buf`, sleeping while the TX ring is full. With interrupts
+// off no THRE interrupt can come, so the ring is fed to the UART by polling.
+static void com_write_all(const void *buf, unsigned int len) {
+    const unsigned char *p = (const unsigned char *)buf;
+
+    if (!com_installed) return;
+
+    while (len > 0) {
+        unsigned int room = (com_tx_tail - com_tx_head - 1) & (COM_TX_BUF_SIZE - 1);
+        if (!room) {
+            if (interrupts_enabled()) {
+                __asm__ __volatile__("hlt"); // THRE interrupt drains the ring
+            } else {
+                while (!(inb(COM1_LSR) & 0x20));
+                outb(COM1_DATA, com_tx_buf[com_tx_tail]);
+                com_tx_tail = (com_tx_tail + 1) & (COM_TX_BUF_SIZE - 1);
+            }
+            continue;
+        }
+        if (room > len) room = len;
+        com_write(p, room);
+        p += room;
+        len -= room;
+    }
+}
+
+// Dequeue up to `len` received bytes. Returns how many were copied.
+static unsigned int com_read(void *buf, unsigned int len) {
+    unsigned char *p = (unsigned char *)buf;
+    unsigned int n = 0;
+
+    while (n < len && com_rx_tail != com_rx_head) {
+        p[n++] = com_rx_buf[com_rx_tail];
+        com_rx_tail = (com_rx_tail + 1) & (COM_RX_BUF_SIZE - 1);
+    }
+    return n;
+}
+
+static unsigned int com_puts(const char *s) {
+    return com_write(s, strlen(s));
+}
+
+// Hand IRQ4 back to the BIOS (before reboot)
+static void com1_shutdown(void) {
+    if (!com_installed) return;
+    pic_mask(COM1_IRQ);
+    outb(COM1_IER, 0x00);
+    outb(COM1_MCR, 0x03);
+    restore_int_vector(COM1_VECTOR, com_old_vector);
+    com_installed = 0;
+}
+
+// Text-mode console writing character cells straight into video memory.
+// The cursor is tracked in software; the CRTC cursor and the BIOS data
+// area are only updated by console_flush so BIOS users (apps) stay in sync.
+
+#define BDA_SEG          0x0040
+#define BDA_VIDEO_MODE   0x49
+#define BDA_SCREEN_COLS  0x4A
+#define BDA_CURSOR_POS   0x50        // Page 0: column, row
+#define BDA_CRTC_PORT    0x63
+#define BDA_SCREEN_ROWS  0x84        // Rows - 1 (EGA and later)
+
+#define CONSOLE_ATTR     0x07        // Light grey on black
+
+extern void far_memsetw(farptr_t dst, unsigned short value, unsigned short count);
+extern void vga_write_cells(farptr_t dst, const char *src, unsigned short len, unsigned char attr);
+
+static unsigned short console_seg;
+static unsigned short console_crtc;
+static unsigned char  console_cols;
+static unsigned char  console_rows;
+static unsigned char  console_row;
+static unsigned char  console_col;
+
+// Serial console: output is mirrored to COM1 and keys are also taken
+// from it, so the shell can be driven from a terminal or a script
+#ifndef SERIAL_CONSOLE
+#define SERIAL_CONSOLE 0
+#endif
+
+static unsigned char console_serial;
+
+// Pick up mode, size and cursor from the BIOS data area
+static void console_sync(void) {
+    unsigned char mode, rows;
+    unsigned short cols, crtc;
+    unsigned char pos[2];
+
+    far_memcpy(near_to_far(&mode), MK_FAR(BDA_SEG, BDA_VIDEO_MODE), 1);
+    far_memcpy(near_to_far(&cols), MK_FAR(BDA_SEG, BDA_SCREEN_COLS), 2);
+    far_memcpy(near_to_far(&crtc), MK_FAR(BDA_SEG, BDA_CRTC_PORT), 2);
+    far_memcpy(near_to_far(&rows), MK_FAR(BDA_SEG, BDA_SCREEN_ROWS), 1);
+    far_memcpy(near_to_far(pos), MK_FAR(BDA_SEG, BDA_CURSOR_POS), 2);
+
+    console_seg = (mode == 7) ? 0xB000 : 0xB800;
+    console_crtc = crtc ? crtc : 0x3D4;
+    console_cols = (cols && cols <= 132) ? cols : 80;
+    console_rows = (rows >= 24 && rows < 60) ? rows + 1 : 25;
+    console_col = pos[0] < console_cols ? pos[0] : 0;
+    console_row = pos[1] < console_rows ? pos[1] : console_rows - 1;
+}
+
+static inline farptr_t console_cell(unsigned char row, unsigned char col) {
+    return MK_FAR(console_seg, (row * console_cols + col) * 2);
+}
+
+// Move the hardware cursor (and the BIOS copy of it) to the software cursor
+static void console_flush(void) {
+    unsigned short pos = console_row * console_cols + console_col;
+    unsigned char bda_pos[2] = { console_col, console_row };
+
+    outb(console_crtc, 0x0E);
+    outb(console_crtc + 1, pos >> 8);
+    outb(console_crtc, 0x0F);
+    outb(console_crtc + 1, pos & 0xFF);
+    far_memcpy(MK_FAR(BDA_SEG, BDA_CURSOR_POS), near_to_far(bda_pos), 2);
+}
+
+static void console_linefeed(void) {
+    if (++console_row < console_rows) return;
+
+    // Scroll: one block move up, then blank the last line
+    unsigned int line = console_cols * 2;
+    far_memcpy(console_cell(0, 0), console_cell(1, 0), (console_rows - 1) * line);
+    far_memsetw(console_cell(console_rows - 1, 0), (CONSOLE_ATTR << 8) | ' ', console_cols);
+    console_row = console_rows - 1;
+}
+
+// Write `len` bytes, handling CR, LF, BS and TAB like the BIOS teletype
+void console_write(const char *buf, unsigned int len) {
+    if (!console_seg) console_sync();
+    if (console_serial) com_write_all(buf, len);
+    kstats.bytes_printed += len;
+
+    while (len > 0) {
+        unsigned char c = *buf;
+
+        if (c == '\r') {
+            console_col = 0;
+        } else if (c == '\n') {
+            console_linefeed();
+        } else if (c == 0x08) {
+            if (console_col > 0) console_col--;
+        } else if (c == '\t') {
+            console_col = (console_col + 8) & ~7;
+            if (console_col >= console_cols) {
+                console_col = 0;
+                console_linefeed();
+            }
+        } else if (c != 0x07) {
+            // Store the longest run of printable bytes that fits on this line
+            unsigned int run = 1;
+            unsigned int room = console_cols - console_col;
+            while (run < len && run < room) {
+                unsigned char d = buf[run];
+                if (d == '\r' || d == '\n' || d == 0x08 || d == '\t' || d == 0x07) break;
+                run++;
+            }
+            vga_write_cells(console_cell(console_row, console_col), buf, run, CONSOLE_ATTR);
+            console_col += run;
+            if (console_col >= console_cols) {
+                console_col = 0;
+                console_linefeed();
+            }
+            buf += run;
+            len -= run;
+            continue;
+        }
+        buf++;
+        len--;
+    }
+}
+
+void console_putc(char c) {
+    console_write(&c, 1);
+}
+
+void console_puts(const char *s) {
+    console_write(s, strlen(s));
+}
+
+void console_newline(void) {
+    console_write("\r\n", 2);
+}
+
+// PS/2 keyboard driver: IRQ1 translates scan code set 1 into keys queued
+// in a ring. Keys use the BIOS layout: ASCII in the low byte, scan code in
+// the high byte; extended (E0-prefixed) keys carry 0xE0 as their ASCII.
+
+#define KBD_DATA        0x60
+#define KBD_IRQ         1
+#define KBD_VECTOR      0x09
+#define KBD_BUF_SIZE    32           // Power of two
+
+#define KBD_SC_LCTRL    0x1D
+#define KBD_SC_LSHIFT   0x2A
+#define KBD_SC_RSHIFT   0x36
+#define KBD_SC_ALT      0x38
+#define KBD_SC_CAPS     0x3A
+
+static const char kbd_map[0x3A] =
+    "\0\x1b" "1234567890-=" "\b\t" "qwertyuiop[]" "\r\0" "asdfghjkl;'`"
+    "\0\\" "zxcvbnm,./" "\0*\0 ";
+
+static const char kbd_map_shift[0x3A] =
+    "\0\x1b" "!@#$%^&*()_+" "\b\t" "QWERTYUIOP{}" "\r\0" "ASDFGHJKL:\"~"
+    "\0|" "ZXCVBNM<>?" "\0*\0 ";
+
+static volatile unsigned short kbd_buf[KBD_BUF_SIZE];
+static volatile unsigned char kbd_head, kbd_tail;
+static unsigned char kbd_shift, kbd_ctrl, kbd_alt, kbd_caps, kbd_extended;
+
+static unsigned char kbd_installed;
+static farptr_t kbd_old_vector;
+
+extern void isr_kbd(void);
+
+static void kbd_push(unsigned short key) {
+    unsigned char next = (kbd_head + 1) & (KBD_BUF_SIZE - 1);
+    if (next == kbd_tail) return;           // Full: drop the key
+    kbd_buf[kbd_head] = key;
+    kbd_head = next;
+}
+
+// Called from isr_kbd with interrupts disabled
+void kbd_irq(void) {
+    unsigned char sc = inb(KBD_DATA);
+
+    if (sc == 0xE0) {
+        kbd_extended = 1;
+        return;
+    }
+
+    unsigned char released = sc & 0x80;
+    unsigned char extended = kbd_extended;
+    sc &= 0x7F;
+    kbd_extended = 0;
+
+    // Modifiers (E0 variants are the right-hand Ctrl/Alt)
+    if (sc == KBD_SC_LCTRL) {
+        kbd_ctrl = !released;
+        return;
+    }
+    if (sc == KBD_SC_ALT) {
+        kbd_alt = !released;
+        return;
+    }
+    if ((sc == KBD_SC_LSHIFT || sc == KBD_SC_RSHIFT) && !extended) {
+        kbd_shift = !released;
+        return;
+    }
+    if (released) return;
+    if (sc == KBD_SC_CAPS) {
+        kbd_caps = !kbd_caps;
+        return;
+    }
+
+    if (extended) {
+        // Arrows, Home/End, Ins/Del, keypad Enter and '/'
+        if (sc == 0x1C) kbd_push((sc << 8) | '\r');
+        else if (sc == 0x35) kbd_push((sc << 8) | '/');
+        else kbd_push((sc << 8) | 0xE0);
+        return;
+    }
+
+    unsigned char c = 0;
+    if (sc < sizeof(kbd_map)) {
+        c = kbd_shift ? kbd_map_shift[sc] : kbd_map[sc];
+        if (kbd_caps && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) c ^= 0x20;
+        if (kbd_ctrl && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) c &= 0x1F;
+    } else if (sc == 0x4A) {
+        c = '-';                            // Keypad minus
+    } else if (sc == 0x4E) {
+        c = '+';                            // Keypad plus
+    }
+    if (kbd_alt) c = 0;                     // Alt combinations carry no ASCII
+
+    kbd_push((sc << 8) | c);
+}
+
+static void kbd_init(void) {
+    if (kbd_installed) return;
+    kbd_head = kbd_tail = 0;
+    set_int_vector(KBD_VECTOR, isr_kbd, &kbd_old_vector);
+    pic_unmask(KBD_IRQ);
+    kbd_installed = 1;
+}
+
+// Give IRQ1 back to the BIOS, e.g. while an app uses INT 16h
+static void kbd_shutdown(void) {
+    if (!kbd_installed) return;
+    restore_int_vector(KBD_VECTOR, kbd_old_vector);
+    kbd_installed = 0;
+}
+
+// Next key, or 0 if none is waiting
+static unsigned short kbd_poll(void) {
+    unsigned short key = 0;
+
+    __asm__ __volatile__("cli");
+    if (kbd_tail != kbd_head) {
+        key = kbd_buf[kbd_tail];
+        kbd_tail = (kbd_tail + 1) & (KBD_BUF_SIZE - 1);
+    }
+    __asm__ __volatile__("sti");
+    return key;
+}
+
+// Work to do while the machine waits for input; set by the current mode
+static void (*idle_hook)(void);
+
+// Cooperative background jobs, run while the shell waits for input. A job
+// is a state machine: each step does one bounded piece of work (at most a
+// track read) and returns non-zero while more is left. A key or serial
+// byte arriving ends the round before the next step.
+#define JOB_MAX 4
+
+#define JOB_SLEEP 0                  // Nothing to do until woken
+#define JOB_READY 1
+
+struct job {
+    const char     *name;
+    int            (*step)(struct job *j);
+    unsigned char  state;
+    unsigned short period_ms;        // Also woken on a timer if non-zero
+    uint32_t       wake_at;          // timer_ticks
+    uint32_t       steps;
+    uint32_t       us;               // Time spent in steps
+};
+
+static struct job jobs[JOB_MAX];
+static unsigned int job_count;
+static unsigned int job_next;        // Round-robin position
+static unsigned char jobs_enabled = 1;
+static uint32_t idle_halted_us;      // Time in HLT waiting for input
+static uint32_t sched_since_us;      // Start of the accounting period
+
+static struct job *job_add(const char *name, int (*step)(struct job *j),
+                           unsigned short period_ms) {
+    if (job_count == JOB_MAX) return 0;
+
+    struct job *j = &jobs[job_count++];
+    j->name = name;
+    j->step = step;
+    j->state = JOB_SLEEP;
+    j->period_ms = period_ms;
+    j->wake_at = timer_ticks + period_ms;
+    return j;
+}
+
+static void job_wake(struct job *j) {
+    if (j) j->state = JOB_READY;
+}
+
+static inline int input_pending(void) {
+    return kbd_tail != kbd_head || (console_serial && com_rx_tail != com_rx_head);
+}
+
+static void sched_run(void) {
+    unsigned int idle = 0;           // Jobs in a row with nothing to do
+
+    while (jobs_enabled && idle < job_count && !input_pending()) {
+        struct job *j = &jobs[job_next];
+        if (++job_next == job_count) job_next = 0;
+
+        if (j->state == JOB_SLEEP && j->period_ms && (int32_t)(timer_ticks - j->wake_at) >= 0) {
+            j->state = JOB_READY;
+        }
+        if (j->state != JOB_READY) {
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        uint32_t start = timer_us();
+        if (!j->step(j)) {
+            j->state = JOB_SLEEP;
+            j->wake_at = timer_ticks + j->period_ms;
+        }
+        j->us += timer_us() - start;
+        j->steps++;
+    }
+}
+
+static void kernel_idle(void) {
+    if (idle_hook) idle_hook();
+    sched_run();
+}
+
+// Next byte from the serial console as a key (CR is Enter, DEL is
+// backspace, LF is dropped), or 0 if none is waiting
+static unsigned short serial_poll(void) {
+    unsigned char c;
+
+    while (com_read(&c, 1)) {
+        if (c == 0x7F) c = 0x08;
+        if (c && c != '\n') return c;
+    }
+    return 0;
+}
+
+// Wait for a key, sleeping in HLT between interrupts
+static unsigned short kbd_get(void) {
+    for (;;) {
+        unsigned short key = kbd_poll();
+        if (!key && console_serial) key = serial_poll();
+        if (key) return key;
+
+        kernel_idle();
+
+        // Re-check with interrupts off; STI's one-instruction shadow makes
+        // STI+HLT atomic, so a key arriving here still wakes the HLT
+        uint32_t halted = timer_us();
+        __asm__ __volatile__("cli");
+        if (!input_pending()) {
+            __asm__ __volatile__("sti\n\thlt");
+        }
+        __asm__ __volatile__("sti");
+        idle_halted_us += timer_us() - halted;
+    }
+}
+
+void read_command(char *buf, unsigned int maxlen) {
+    unsigned int i = 0;
+
+    while (i < maxlen - 1) {
+        console_flush();            // show the cursor while waiting
+        unsigned char c = kbd_get() & 0xFF;
+
+        if (c == '\r') {            // Enter
+            break;
+        } else if (c == 0x08) {     // Backspace
+            if (i > 0) {
+                i--;                        // remove from buffer
+                console_write("\b \b", 3);   // back, blank, back again
+            }
+        } else if (c == 0 || c == 0xE0) {
+            continue;               // function and cursor keys
+        } else {
+            buf[i++] = c;           // add to buffer
+            console_putc(c);        // echo
+        }
+    }
+
+    buf[i] = 0; // null-terminate
+    console_newline(); // move to next line after Enter
+}
+
+
+void console_putdec(uint32_t val) {
+    char buf[11];
+    console_write(buf, u32_to_dec(val, buf));
+}
+
+static void com1_stat(void) {
+    if (!com_installed) {
+        console_puts("COM1 not initialized, use 'com' first.");
+        console_newline();
+        return;
+    }
+    console_puts("COM1: ");
+    console_putdec(com_baud);
+    console_puts(" baud, FIFO trigger ");
+    console_putdec(com_fifo_trigger);
+    console_newline();
+    console_puts("RX pending: ");
+    console_putdec((com_rx_head - com_rx_tail) & (COM_RX_BUF_SIZE - 1));
+    console_puts("  TX pending: ");
+    console_putdec((com_tx_head - com_tx_tail) & (COM_TX_BUF_SIZE - 1));
+    console_newline();
+    console_puts("RX overruns: ");
+    console_putdec(com_rx_overruns);
+    console_puts("  RX dropped: ");
+    console_putdec(com_rx_dropped);
+    console_puts("  TX dropped: ");
+    console_putdec(com_tx_dropped);
+    console_newline();
+}
+
+// Idle hook for the 'com' mode: show received bytes while the user types
+static void com_echo_rx(void) {
+    char rx[64];
+    unsigned int n;
+    unsigned char shown = 0;
+
+    while ((n = com_read(rx, sizeof(rx))) > 0) {
+        console_write(rx, n);
+        shown = 1;
+    }
+    if (shown) console_flush();
+}
+
+// Sampling profiler: every `prof_interval` timer ticks the interrupted
+// CS:IP is counted. Kernel addresses go into a histogram of 16-byte buckets
+// in far memory, covering the whole kernel segment; anything else (BIOS,
+// apps) is counted per segment. 'prof dump' sends it all to COM1 as CSV
+// for tools/prof.py to match against the kernel's symbols.
+#define PROF_SHIFT    4                      // 16 bytes per bucket
+#define PROF_BUCKETS  (0x10000 >> PROF_SHIFT)
+#define PROF_SEGS     8
+
+struct prof_seg {
+    unsigned short seg;
+    uint32_t       count;
+};
+
+static unsigned short prof_hist;             // Segment of the histogram, 0 until first use
+static uint32_t prof_samples, prof_kernel, prof_other;
+static struct prof_seg prof_segs[PROF_SEGS];
+static unsigned int prof_seg_count;
+
+// In the timer interrupt, on whatever stack was interrupted: SS may be an
+// app's, so the counter goes through a static rather than a local.
+// Counters stop at 0xFFFF rather than wrap.
+static uint16_t prof_word;
+
+static void prof_sample(unsigned short ip, unsigned short cs) {
+    prof_samples++;
+    if (cs == get_cs()) {
+        farptr_t at = MK_FAR(prof_hist, (ip >> PROF_SHIFT) * 2);
+        far_memcpy(near_to_far(&prof_word), at, 2);
+        if (prof_word != 0xFFFF) prof_word++;
+        far_memcpy(at, near_to_far(&prof_word), 2);
+        prof_kernel++;
+        return;
+    }
+
+    for (unsigned int i = 0; i < prof_seg_count; i++) {
+        if (prof_segs[i].seg == cs) {
+            prof_segs[i].count++;
+            return;
+        }
+    }
+    if (prof_seg_count < PROF_SEGS) {
+        prof_segs[prof_seg_count].seg = cs;
+        prof_segs[prof_seg_count].count = 1;
+        prof_seg_count++;
+    } else {
+        prof_other++;
+    }
+}
+
+static uint16_t prof_bucket(unsigned int i) {
+    uint16_t n;
+    far_memcpy(near_to_far(&n), MK_FAR(prof_hist, i * 2), 2);
+    return n;
+}
+
+// Clear the counts and sample every `interval` ms
+static int prof_start(unsigned int interval) {
+    prof_running = 0;
+    if (!prof_hist && !(prof_hist = mem_alloc(PROF_BUCKETS * 2 / 16, MEM_TAG_PROF))) return -1;
+
+    far_zero(MK_FAR(prof_hist, 0), PROF_BUCKETS * 2);
+    prof_samples = prof_kernel = prof_other = 0;
+    prof_seg_count = 0;
+    prof_interval = prof_countdown = interval ? interval : 1;
+    prof_running = 1;
+    return 0;
+}
+
+static void prof_stat(void) {
+    unsigned int top[5] = { 0 };
+
+    console_puts(prof_running ? "Profiling every " : "Stopped, every ");
+    console_putdec(prof_interval);
+    console_puts(" ms: ");
+    console_putdec(prof_samples);
+    console_puts(" samples, ");
+    console_putdec(prof_kernel);
+    console_puts(" in the kernel");
+    console_newline();
+    if (!prof_hist || !prof_samples) return;
+
+    // Busiest buckets, by insertion into a short sorted list
+    for (unsigned int i = 0; i < PROF_BUCKETS; i++) {
+        uint16_t n = prof_bucket(i);
+        if (!n || n <= prof_bucket(top[4])) continue;
+        unsigned int k = 4;
+        while (k > 0 && n > prof_bucket(top[k - 1])) {
+            top[k] = top[k - 1];
+            k--;
+        }
+        top[k] = i;
+    }
+    for (unsigned int k = 0; k < 5 && prof_bucket(top[k]); k++) {
+        console_puts("  offset ");
+        console_putdec((uint32_t)top[k] << PROF_SHIFT);
+        console_puts(": ");
+        console_putdec(prof_bucket(top[k]));
+        console_newline();
+    }
+    for (unsigned int i = 0; i < prof_seg_count; i++) {
+        console_puts("  segment ");
+        console_putdec(prof_segs[i].seg);
+        console_puts(": ");
+        console_putdec(prof_segs[i].count);
+        console_newline();
+    }
+}
+
+static void prof_line(char tag, uint32_t a, uint32_t b) {
+    char buf[24];
+    unsigned int n = 0;
+
+    buf[n++] = tag;
+    buf[n++] = ',';
+    n += u32_to_dec(a, buf + n);
+    buf[n++] = ',';
+    n += u32_to_dec(b, buf + n);
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    com_write_all(buf, n);
+}
+
+// CSV on COM1: a "p,interval,samples" line, "b,offset,count" per kernel
+// bucket in use, "s,segment,count" per other segment, "o,0,count" for
+// segments that did not fit, then "e,0,0"
+static void prof_dump(void) {
+    prof_line('p', prof_interval, prof_samples);
+    for (unsigned int i = 0; prof_hist && i < PROF_BUCKETS; i++) {
+        uint16_t n = prof_bucket(i);
+        if (n) prof_line('b', (uint32_t)i << PROF_SHIFT, n);
+    }
+    for (unsigned int i = 0; i < prof_seg_count; i++) {
+        prof_line('s', prof_segs[i].seg, prof_segs[i].count);
+    }
+    if (prof_other) prof_line('o', 0, prof_other);
+    prof_line('e', 0, 0);
+}
+
+int strcmp(const char *a, const char *b) {
+    while (*a && (*a == *b)) {
+        a++;
+        b++;
+    }
+    return *(const unsigned char*)a - *(const unsigned char*)b;
+}
+
+extern unsigned char bios_read_sector(
+    unsigned char drive,
+    unsigned char head,
+    unsigned char track,
+    unsigned char sector,
+    void* buffer
+);
+
+// Reads `count` sectors from one track into a far buffer in a single request
+// (split internally only at 64 KB DMA boundaries)
+extern unsigned char bios_read_sectors(
+    unsigned char drive,
+    unsigned char head,
+    unsigned short track,
+    unsigned char sector,
+    unsigned char count,
+    farptr_t buffer
+);
+
+// Same, writing: INT 13h AH=03h
+extern unsigned char bios_write_sectors(
+    unsigned char drive,
+    unsigned char head,
+    unsigned short track,
+    unsigned char sector,
+    unsigned char count,
+    farptr_t buffer
+);
+
+// Disk backends under the track cache: INT 13h, or the native 82077 driver
+#define DISK_BACKEND_BIOS 0
+#define DISK_BACKEND_FDC  1
+
+#ifndef DISK_USE_FDC
+#define DISK_USE_FDC 0
+#endif
+
+static unsigned char disk_backend = DISK_USE_FDC ? DISK_BACKEND_FDC : DISK_BACKEND_BIOS;
+
+#define BDA_FDC_RECAL    0x3E        // Bit 7 set by the BIOS IRQ6 handler
+#define BDA_FDC_MOTOR    0x3F        // Motor-on bits, one per drive
+#define BDA_FDC_TIMEOUT  0x40        // Ticks until the BIOS stops the motor
+#define BDA_TICKS        0x6C        // 18.2 Hz tick count (dword)
+
+// BIOS tick count, 18.2 Hz
+static uint32_t bios_ticks(void) {
+    uint32_t t;
+    __asm__ __volatile__("cli");
+    far_memcpy(near_to_far(&t), MK_FAR(BDA_SEG, BDA_TICKS), 4);
+    __asm__ __volatile__("sti");
+    return t;
+}
+
+static unsigned char bda_peekb(unsigned short off) {
+    unsigned char v;
+    far_memcpy(near_to_far(&v), MK_FAR(BDA_SEG, off), 1);
+    return v;
+}
+
+static void bda_pokeb(unsigned short off, unsigned char v) {
+    far_memcpy(MK_FAR(BDA_SEG, off), near_to_far(&v), 1);
+}
+
+// Native floppy driver: programs the 82077 and DMA channel 2 directly.
+// Completion interrupts are taken from the BIOS IRQ6 handler, which sets
+// bit 7 of BDA 0x3E; the BIOS timer also still switches the motor off once
+// BDA 0x40 counts down, so the idle timeout is just that counter.
+
+#define FDC_DOR   0x3F2
+#define FDC_MSR   0x3F4
+#define FDC_FIFO  0x3F5
+#define FDC_CCR   0x3F7
+
+#define FDC_CMD_SPECIFY     0x03
+#define FDC_CMD_SENSE_DRIVE 0x04
+#define FDC_CMD_RECALIBRATE 0x07
+#define FDC_CMD_SENSE_INT   0x08
+#define FDC_CMD_SEEK        0x0F
+#define FDC_CMD_VERSION     0x10
+#define FDC_CMD_CONFIGURE   0x13
+#define FDC_CMD_READ        0xE6     // MT | MFM | SK | READ DATA
+#define FDC_CMD_WRITE       0xC5     // MT | MFM | WRITE DATA
+
+#define DMA_MASK   0x0A
+#define DMA_MODE   0x0B
+#define DMA_FLIP   0x0C
+#define DMA2_ADDR  0x04
+#define DMA2_COUNT 0x05
+#define DMA2_PAGE  0x81
+
+#define FDC_MOTOR_IDLE_TICKS 91      // ~5 s of inactivity
+#define FDC_SPINUP_TICKS     9       // ~500 ms
+#define FDC_IRQ_TIMEOUT      37      // ~2 s
+
+static unsigned char fdc_ready;            // Reset and configured
+static unsigned char fdc_implied_seek;     // 82077 EIS enabled
+static unsigned char fdc_data_rate;
+static unsigned short fdc_cyl = 0xFFFF;    // Cylinder under the heads
+static unsigned short fdc_seek_target = 0xFFFF;  // Seek-ahead in flight
+
+static uint32_t fdc_ops;
+static uint32_t fdc_sectors;
+static uint32_t fdc_ticks_total;
+static uint32_t fdc_last_ticks;
+static uint32_t fdc_retries;
+static uint32_t fdc_fallbacks;
+
+static int fdc_write_byte(unsigned char b) {
+    for (unsigned int i = 0; i < 0xFFFF; i++) {
+        if ((inb(FDC_MSR) & 0xC0) == 0x80) {
+            outb(FDC_FIFO, b);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int fdc_read_byte(void) {
+    for (unsigned int i = 0; i < 0xFFFF; i++) {
+        if ((inb(FDC_MSR) & 0xC0) == 0xC0) return inb(FDC_FIFO);
+    }
+    return -1;
+}
+
+static void fdc_clear_irq(void) {
+    bda_pokeb(BDA_FDC_RECAL, bda_peekb(BDA_FDC_RECAL) & 0x7F);
+}
+
+// Sleep until the BIOS IRQ6 handler flags completion
+static int fdc_wait_irq(void) {
+    uint32_t start = bios_ticks();
+    while (!(bda_peekb(BDA_FDC_RECAL) & 0x80)) {
+        if (bios_ticks() - start > FDC_IRQ_TIMEOUT) return -1;
+        __asm__ __volatile__("sti\n\thlt");
+    }
+    fdc_clear_irq();
+    return 0;
+}
+
+static int fdc_sense_interrupt(unsigned char *st0, unsigned char *cyl) {
+    if (fdc_write_byte(FDC_CMD_SENSE_INT)) return -1;
+    int a = fdc_read_byte();
+    int b = fdc_read_byte();
+    if (a < 0 || b < 0) return -1;
+    *st0 = a;
+    *cyl = b;
+    return 0;
+}
+
+static void fdc_motor_on(unsigned char drive) {
+    // Keep the BIOS from stopping the motor mid-operation
+    bda_pokeb(BDA_FDC_TIMEOUT, 0xFF);
+
+    unsigned char motors = bda_peekb(BDA_FDC_MOTOR);
+    if (motors & (1 << drive)) return;
+
+    outb(FDC_DOR, 0x0C | drive | (0x10 << drive));
+    bda_pokeb(BDA_FDC_MOTOR, (motors & 0xF0) | (1 << drive));
+
+    uint32_t start = bios_ticks();
+    while (bios_ticks() - start < FDC_SPINUP_TICKS) __asm__ __volatile__("sti\n\thlt");
+}
+
+static void fdc_motor_idle(void) {
+    bda_pokeb(BDA_FDC_TIMEOUT, FDC_MOTOR_IDLE_TICKS);
+}
+
+static int fdc_recalibrate(unsigned char drive) {
+    unsigned char st0, cyl;
+    for (int i = 0; i < 2; i++) {           // 80+ tracks may need two passes
+        fdc_clear_irq();
+        if (fdc_write_byte(FDC_CMD_RECALIBRATE) || fdc_write_byte(drive)) return -1;
+        if (fdc_wait_irq() || fdc_sense_interrupt(&st0, &cyl)) return -1;
+        if (!(st0 & 0xC0) && cyl == 0) {
+            fdc_cyl = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Reset the controller and program it for `drive` on the mounted media
+static int fdc_reset(unsigned char drive) {
+    unsigned char st0, cyl;
+
+    fdc_ready = 0;
+    fdc_cyl = 0xFFFF;
+    fdc_seek_target = 0xFFFF;
+
+    fdc_clear_irq();
+    outb(FDC_DOR, 0x00);
+    outb(FDC_DOR, 0x0C | drive | (bda_peekb(BDA_FDC_MOTOR) & 0x0F) << 4);
+    if (fdc_wait_irq()) return -1;
+    for (int i = 0; i < 4; i++) {
+        if (fdc_sense_interrupt(&st0, &cyl)) return -1;
+    }
+
+    outb(FDC_CCR, fdc_data_rate);
+
+    // 82077 and later: FIFO on, polling off, implied seeks on
+    fdc_implied_seek = 0;
+    if (!fdc_write_byte(FDC_CMD_VERSION) && fdc_read_byte() == 0x90) {
+        if (!fdc_write_byte(FDC_CMD_CONFIGURE) && !fdc_write_byte(0x00) &&
+            !fdc_write_byte(0x57) && !fdc_write_byte(0x00)) {
+            fdc_implied_seek = 1;
+        }
+    }
+
+    // Step rate 3 ms, head unload 240 ms, head load 4 ms, DMA mode
+    if (fdc_write_byte(FDC_CMD_SPECIFY) || fdc_write_byte(0xDF) || fdc_write_byte(0x02)) {
+        return -1;
+    }
+
+    fdc_motor_on(drive);
+    if (fdc_recalibrate(drive)) return -1;
+
+    fdc_ready = 1;
+    return 0;
+}
+
+// Collect the completion of a seek-ahead, if one is outstanding
+static int fdc_finish_seek(void) {
+    unsigned char st0, cyl;
+
+    if (fdc_seek_target == 0xFFFF) return 0;
+    if (fdc_wait_irq() || fdc_sense_interrupt(&st0, &cyl) || (st0 & 0xC0)) {
+        fdc_seek_target = 0xFFFF;
+        fdc_cyl = 0xFFFF;
+        return -1;
+    }
+    fdc_cyl = cyl;
+    fdc_seek_target = 0xFFFF;
+    return 0;
+}
+
+static int fdc_start_seek(unsigned char drive, unsigned short cyl, unsigned char head) {
+    fdc_clear_irq();
+    if (fdc_write_byte(FDC_CMD_SEEK) || fdc_write_byte((head << 2) | drive) ||
+        fdc_write_byte(cyl)) {
+        return -1;
+    }
+    fdc_seek_target = cyl;
+    return 0;
+}
+
+// Start stepping to `cyl` without waiting, so the heads move while the
+// caller copies out the track it just read
+static void fdc_seek_ahead(unsigned char drive, unsigned short cyl) {
+    if (!fdc_ready || cyl == fdc_cyl || cyl >= disk_geom.cylinders) return;
+    if (fdc_finish_seek()) return;
+    fdc_start_seek(drive, cyl, 0);
+}
+
+static void fdc_dma_setup(farptr_t buf, unsigned int bytes, unsigned char write) {
+    uint32_t phys = ((uint32_t)FAR_SEG(buf) << 4) + FAR_OFF(buf);
+    unsigned int count = bytes - 1;
+
+    outb(DMA_MASK, 0x06);                   // Mask channel 2
+    outb(DMA_FLIP, 0xFF);                   // Reset the address flip-flop
+    outb(DMA_MODE, write ? 0x4A : 0x46);    // Single, increment, read/write memory
+    outb(DMA2_ADDR, phys & 0xFF);
+    outb(DMA2_ADDR, (phys >> 8) & 0xFF);
+    outb(DMA2_PAGE, (phys >> 16) & 0x0F);
+    outb(DMA_FLIP, 0xFF);
+    outb(DMA2_COUNT, count & 0xFF);
+    outb(DMA2_COUNT, count >> 8);
+    outb(DMA_MASK, 0x02);                   // Unmask channel 2
+}
+
+// Read (or write) `count` sectors starting at CHS into (from) `buf`. With
+// head 0 the run may continue onto head 1 of the same cylinder
+// (multi-track). The buffer must not cross a 64 KB physical boundary.
+static int fdc_transfer(unsigned char drive, unsigned short cyl, unsigned char head,
+                        unsigned char sector, unsigned int count, farptr_t buf,
+                        unsigned char write) {
+    uint32_t start = bios_ticks();
+    int result = -1;
+
+    if (drive > 3) return -1;
+
+    fdc_motor_on(drive);
+    if (fdc_finish_seek()) fdc_ready = 0;
+
+    for (int attempt = 0; attempt < 3 && result; attempt++) {
+        if (attempt) fdc_retries++;
+        if (!fdc_ready && fdc_reset(drive)) continue;
+
+        // Without implied seeks the heads have to be positioned first
+        if (!fdc_implied_seek && fdc_cyl != cyl) {
+            unsigned char st0, c;
+            if (fdc_start_seek(drive, cyl, head) || fdc_wait_irq() ||
+                fdc_sense_interrupt(&st0, &c) || (st0 & 0xC0)) {
+                fdc_seek_target = 0xFFFF;
+                continue;
+            }
+            fdc_seek_target = 0xFFFF;
+            fdc_cyl = c;
+        }
+
+        fdc_dma_setup(buf, count * 512, write);
+        fdc_clear_irq();
+        if (fdc_write_byte(write ? FDC_CMD_WRITE : FDC_CMD_READ) ||
+            fdc_write_byte((head << 2) | drive) ||
+            fdc_write_byte(cyl) ||
+            fdc_write_byte(head) ||
+            fdc_write_byte(sector) ||
+            fdc_write_byte(2) ||                            // 512-byte sectors
+            fdc_write_byte(disk_geom.sectors_per_track) ||  // EOT
+            fdc_write_byte(0x1B) ||                         // Gap length
+            fdc_write_byte(0xFF)) {
+            fdc_ready = 0;
+            continue;
+        }
+        if (fdc_wait_irq()) {
+            fdc_ready = 0;
+            continue;
+        }
+
+        unsigned char st[7];
+        int ok = 1;
+        for (int i = 0; i < 7; i++) {
+            int b = fdc_read_byte();
+            if (b < 0) ok = 0;
+            st[i] = b;
+        }
+        if (!ok) {
+            fdc_ready = 0;
+            continue;
+        }
+        fdc_cyl = cyl;
+        if (!(st[0] & 0xC0)) {
+            result = 0;
+        } else if (st[1] & 0x02) {
+            break;                          // Write protected: no point retrying
+        } else {
+            fdc_ready = 0;                  // Reset and recalibrate on retry
+        }
+    }
+
+    fdc_motor_idle();
+
+    fdc_last_ticks = bios_ticks() - start;
+    fdc_ticks_total += fdc_last_ticks;
+    fdc_ops++;
+    if (!result) fdc_sectors += count;
+    return result;
+}
+
+// Pick the data rate for the mounted media; the controller is reset on
+// its next use
+static void fdc_configure(void) {
+    unsigned int spt = disk_geom.sectors_per_track;
+    fdc_data_rate = spt >= 36 ? 0x03 : spt >= 15 ? 0x00 : 0x02;  // 1M/500K/250K
+    fdc_ready = 0;
+}
+
+// Hand the drive to INT 13h: collect any seek-ahead first, since the BIOS
+// handler takes the IRQ6 flag, and forget where the heads are, since the
+// BIOS moves them
+static void fdc_release(void) {
+    fdc_finish_seek();
+    fdc_ready = 0;
+    fdc_cyl = 0xFFFF;
+}
+
+// Read or write sectors through the selected backend. Runs may only span
+// two heads when the FDC backend is active; INT 13h requests stay within
+// one track.
+static int disk_transfer_raw(unsigned char drive, unsigned short cyl, unsigned char head,
+                             unsigned char sector, unsigned int count, farptr_t buf,
+                             unsigned char write) {
+    if (write) {
+        kstats.disk_writes++;
+        kstats.disk_sectors_written += count;
+    } else {
+        kstats.disk_sectors += count;
+    }
+    if (disk_backend == DISK_BACKEND_FDC) {
+        if (!fdc_transfer(drive, cyl, head, sector, count, buf, write)) return 0;
+        fdc_fallbacks++;
+        fdc_release();
+    }
+
+    // INT 13h, one track at a time
+    while (count > 0) {
+        unsigned int run = disk_geom.sectors_per_track - (sector - 1);
+        if (run > count) run = count;
+        if ((write ? bios_write_sectors : bios_read_sectors)(drive, head, cyl, sector, run, buf)) {
+            return -1;
+        }
+        count -= run;
+        buf = FAR_ADD_SECTORS(buf, run);
+        sector = 1;
+        head++;
+    }
+    return 0;
+}
+
+static void fdc_stat(void) {
+    console_puts("Disk backend: ");
+    console_puts(disk_backend == DISK_BACKEND_FDC ? "native FDC" : "BIOS INT 13h");
+    console_newline();
+    console_puts("FDC ops: ");
+    console_putdec(fdc_ops);
+    console_puts("  Sectors: ");
+    console_putdec(fdc_sectors);
+    console_puts("  Retries: ");
+    console_putdec(fdc_retries);
+    console_puts("  Fallbacks: ");
+    console_putdec(fdc_fallbacks);
+    console_newline();
+    console_puts("Last op: ");
+    console_putdec(umul32_16(fdc_last_ticks, 55));
+    console_puts(" ms  Total: ");
+    console_putdec(umul32_16(fdc_ticks_total, 55));
+    console_puts(" ms");
+    if (fdc_ops) {
+        console_puts("  Avg: ");
+        console_putdec(udiv32(umul32_16(fdc_ticks_total, 55), fdc_ops, 0));
+        console_puts(" ms");
+    }
+    console_newline();
+    console_puts("Implied seeks: ");
+    console_puts(fdc_implied_seek ? "on" : "off");
+    console_newline();
+}
+
+// Track cache: whole tracks live in a DMA-safe pool on the far heap, so a
+// slot never crosses a 64 KB boundary and is always filled with a single
+// request. With the FDC backend, two slots adjacent in the same window can
+// take a whole cylinder in one transfer. Fewer slots than DISK_CACHE_SLOTS
+// are used when memory is short.
+//
+// Writes are write-back: they land in the slot and mark a range of dirty
+// sectors, which goes to the drive in one request when the slot is evicted
+// or on disk_sync.
+#ifndef DISK_CACHE_SLOTS
+#define DISK_CACHE_SLOTS 4
+#endif
+
+struct track_slot {
+    unsigned char  valid;
+    unsigned char  drive;
+    unsigned char  head;
+    unsigned short cyl;
+    unsigned short last_used;        // LRU stamp
+    unsigned short seg;              // Buffer, from track_pool
+    unsigned char  dirty_lo;         // Dirty sectors, 1-based; 0 when clean
+    unsigned char  dirty_hi;
+};
+
+static struct mem_pool track_pool;
+static struct track_slot track_cache[DISK_CACHE_SLOTS];
+static unsigned int track_cache_slots;   // Slots usable with current geometry
+static unsigned int track_cache_spt;     // Sectors per cached track
+static unsigned short track_cache_clock;
+
+static uint32_t cache_hits;
+static uint32_t cache_misses;
+static uint32_t cache_evictions;
+static uint32_t cache_writebacks;
+
+static inline farptr_t disk_cache_slot_addr(unsigned int slot) {
+    return MK_FAR(track_cache[slot].seg, 0);
+}
+
+// Write the dirty sectors of slot `index` to the drive in one request
+static int disk_cache_writeback(unsigned int index) {
+    struct track_slot *s = &track_cache[index];
+
+    if (!s->valid || !s->dirty_lo) return 0;
+    if (disk_transfer_raw(s->drive, s->cyl, s->head, s->dirty_lo, s->dirty_hi - s->dirty_lo + 1,
+                          FAR_ADD_SECTORS(disk_cache_slot_addr(index), s->dirty_lo - 1), 1)) {
+        return -1;
+    }
+    s->dirty_lo = s->dirty_hi = 0;
+    cache_writebacks++;
+    return 0;
+}
+
+// Write back every dirty slot. Returns -1 if any of them failed; those
+// stay dirty.
+int disk_sync(void) {
+    int result = 0;
+    for (unsigned int i = 0; i < track_cache_slots; i++) {
+        if (disk_cache_writeback(i)) result = -1;
+    }
+    return result;
+}
+
+// Drop every cached track (media change), writing back what is dirty
+static void disk_cache_flush(void) {
+    disk_sync();
+    for (unsigned int i = 0; i < DISK_CACHE_SLOTS; i++) {
+        track_cache[i].valid = 0;
+        track_cache[i].dirty_lo = track_cache[i].dirty_hi = 0;
+    }
+}
+
+// Size the slots for a track of `spt` sectors; flushes on geometry change
+static void disk_cache_configure(unsigned int spt) {
+    if (spt == track_cache_spt) return;
+
+    disk_cache_flush();
+    pool_destroy(&track_pool);
+    track_cache_spt = spt;
+    track_cache_slots = pool_init(&track_pool, "track", spt * 512, DISK_CACHE_SLOTS, 1);
+    for (unsigned int i = 0; i < track_cache_slots; i++) {
+        track_cache[i].seg = FAR_SEG(pool_get(&track_pool));
+    }
+}
+
+// Slots `slot` and `slot + 1` form one DMA-safe buffer for a cylinder
+static int disk_cache_adjacent(unsigned int slot) {
+    unsigned short seg = track_cache[slot].seg;
+    return track_cache[slot + 1].seg == seg + track_cache_spt * 32 &&
+           (seg >> 12) == ((seg + track_cache_spt * 64 - 1) >> 12);
+}
+
+static int disk_cache_lookup(unsigned char drive, unsigned short cyl, unsigned char head) {
+    for (unsigned int i = 0; i < track_cache_slots; i++) {
+        struct track_slot *s = &track_cache[i];
+        if (s->valid && s->drive == drive && s->cyl == cyl && s->head == head) return i;
+    }
+    return -1;
+}
+
+static void disk_cache_set(unsigned int index, unsigned char drive, unsigned short cyl,
+                           unsigned char head) {
+    struct track_slot *s = &track_cache[index];
+    s->drive = drive;
+    s->cyl = cyl;
+    s->head = head;
+    s->last_used = track_cache_clock;
+    s->dirty_lo = s->dirty_hi = 0;
+    s->valid = 1;
+}
+
+// Load track (cyl, head) into slot `index`. With the FDC, the other head of
+// the cylinder comes along in the same multi-track read when the adjacent
+// slot is free or cold (and clean, or written back first).
+static int disk_cache_fill(unsigned int index, unsigned char drive, unsigned short cyl,
+                           unsigned char head) {
+    unsigned int first = index;
+    unsigned int count = track_cache_spt;
+
+    if (disk_backend == DISK_BACKEND_FDC && disk_geom.num_heads == 2) {
+        int buddy = head ? (int)index - 1 : (int)index + 1;
+        if (buddy >= 0 && buddy < (int)track_cache_slots &&
+            disk_cache_adjacent(head ? (unsigned int)buddy : index) &&
+            disk_cache_lookup(drive, cyl, head ^ 1) < 0) {
+            struct track_slot *b = &track_cache[buddy];
+            if (!b->valid ||
+                ((unsigned short)(track_cache_clock - b->last_used) >= track_cache_slots &&
+                 !disk_cache_writeback(buddy))) {
+                if (b->valid) cache_evictions++;
+                b->valid = 0;
+                first = head ? (unsigned int)buddy : index;
+                count = track_cache_spt * 2;
+            }
+        }
+    }
+
+    if (disk_transfer_raw(drive, cyl, count > track_cache_spt ? 0 : head, 1, count,
+                          disk_cache_slot_addr(first), 0)) {
+        return -1;
+    }
+
+    if (count > track_cache_spt) {
+        disk_cache_set(first, drive, cyl, 0);
+        disk_cache_set(first + 1, drive, cyl, 1);
+    } else {
+        disk_cache_set(index, drive, cyl, head);
+    }
+
+    // Sequential reads continue on the next cylinder: start stepping now
+    if (disk_backend == DISK_BACKEND_FDC &&
+        (count > track_cache_spt || head == disk_geom.num_heads - 1)) {
+        fdc_seek_ahead(drive, cyl + 1);
+    }
+    return 0;
+}
+
+// Slot holding track (cyl, head). On a miss the least recently used slot
+// is evicted (written back first if dirty) and, if `fill`, the whole track
+// is loaded into it; without `fill` the caller is about to overwrite the
+// whole track. -1 if there are no slots or the write-back or fill fails.
+static int disk_cache_get(unsigned char drive, unsigned short cyl, unsigned char head,
+                          unsigned char fill) {
+    struct track_slot *slot = 0;
+    unsigned int index = 0;
+    int found = disk_cache_lookup(drive, cyl, head);
+
+    if (found >= 0) {
+        index = found;
+        cache_hits++;
+    } else {
+        cache_misses++;
+        if (!track_cache_slots) return -1;
+
+        // Prefer an empty slot, otherwise evict the oldest one
+        for (unsigned int i = 0; i < track_cache_slots; i++) {
+            struct track_slot *s = &track_cache[i];
+            if (!s->valid) {
+                slot = s;
+                index = i;
+                break;
+            }
+            if (!slot || (unsigned short)(track_cache_clock - s->last_used) >
+                         (unsigned short)(track_cache_clock - slot->last_used)) {
+                slot = s;
+                index = i;
+            }
+        }
+        if (slot->valid) {
+            if (disk_cache_writeback(index)) return -1;
+            cache_evictions++;
+        }
+
+        slot->valid = 0;
+        if (fill) {
+            if (disk_cache_fill(index, drive, cyl, head)) return -1;
+        } else {
+            disk_cache_set(index, drive, cyl, head);
+        }
+    }
+
+    track_cache[index].last_used = ++track_cache_clock;
+    return index;
+}
+
+// Copy `count` sectors of one track, starting at 1-based `sector`, to `dst`
+static int disk_cache_read(unsigned char drive, unsigned short cyl, unsigned char head,
+                           unsigned char sector, unsigned int count, farptr_t dst) {
+    int index = disk_cache_get(drive, cyl, head, 1);
+
+    // No cache, or a bad sector elsewhere on the track: read just what was asked
+    if (index < 0) return disk_transfer_raw(drive, cyl, head, sector, count, dst, 0);
+
+    far_memcpy(dst, FAR_ADD_SECTORS(disk_cache_slot_addr(index), sector - 1), count * 512);
+    return 0;
+}
+
+// Copy `count` sectors from `src` into one track and mark them dirty. A
+// whole track replaces the slot without reading it first.
+static int disk_cache_write(unsigned char drive, unsigned short cyl, unsigned char head,
+                            unsigned char sector, unsigned int count, farptr_t src) {
+    int index = disk_cache_get(drive, cyl, head, count < track_cache_spt);
+
+    // No cache, or the track cannot be read: write through
+    if (index < 0) return disk_transfer_raw(drive, cyl, head, sector, count, src, 1);
+
+    struct track_slot *s = &track_cache[index];
+    far_memcpy(FAR_ADD_SECTORS(disk_cache_slot_addr(index), sector - 1), src, count * 512);
+    if (!s->dirty_lo || sector < s->dirty_lo) s->dirty_lo = sector;
+    if (sector + count - 1 > s->dirty_hi) s->dirty_hi = sector + count - 1;
+    return 0;
+}
+
+static uint32_t cache_prefetches;
+
+// Pull the track holding `lba` into the cache ahead of use. Returns 1 if
+// it had to be read.
+static int disk_prefetch(unsigned int lba) {
+    struct chs_cursor pos;
+
+    if (!track_cache_slots) return 0;
+    chs_seek(&disk_geom, &pos, lba);
+    if (disk_cache_lookup(disk_geom.drive, pos.cyl, pos.head) >= 0) return 0;
+
+    cache_prefetches++;
+    disk_cache_get(disk_geom.drive, pos.cyl, pos.head, 1);
+    return 1;
+}
+
+static void disk_cache_stat(void) {
+    console_puts("Track cache: ");
+    console_putdec(track_cache_slots);
+    console_puts(" slots x ");
+    console_putdec(track_cache_spt);
+    console_puts(" sectors");
+    console_newline();
+    console_puts("Hits: ");
+    console_putdec(cache_hits);
+    console_puts("  Misses: ");
+    console_putdec(cache_misses);
+    console_puts("  Evictions: ");
+    console_putdec(cache_evictions);
+    console_puts("  Prefetched: ");
+    console_putdec(cache_prefetches);
+    console_newline();
+
+    unsigned int dirty = 0;
+    for (unsigned int i = 0; i < track_cache_slots; i++) {
+        if (track_cache[i].valid && track_cache[i].dirty_lo) dirty++;
+    }
+    console_puts("Dirty: ");
+    console_putdec(dirty);
+    console_puts("  Write-backs: ");
+    console_putdec(cache_writebacks);
+    console_newline();
+
+    uint32_t lookups = cache_hits + cache_misses;
+    if (lookups) {
+        console_puts("Hit rate: ");
+        console_putdec(udiv32(umul32_16(cache_hits, 100), lookups, 0));
+        console_puts("%");
+        console_newline();
+    }
+}
+
+static void kstats_line(const char *key, uint32_t val, unsigned char to_com) {
+    char buf[11];
+    unsigned int n = u32_to_dec(val, buf);
+
+    if (to_com) {
+        // Waits for room like prof_dump, so no line is cut short
+        com_write_all(key, strlen(key));
+        com_write_all("=", 1);
+        com_write_all(buf, n);
+        com_write_all("\r\n", 2);
+    } else {
+        console_puts(key);
+        console_puts("=");
+        console_write(buf, n);
+        console_newline();
+    }
+}
+
+// Print the counters as key=value lines, to the screen or to COM1
+static void kstats_dump(unsigned char to_com) {
+    kstats_line("uptime_ms", timer_ticks, to_com);
+    kstats_line("sectors_read", kstats.sectors_read, to_com);
+    kstats_line("disk_sectors", kstats.disk_sectors, to_com);
+    kstats_line("sectors_written", kstats.sectors_written, to_com);
+    kstats_line("disk_writes", kstats.disk_writes, to_com);
+    kstats_line("disk_sectors_written", kstats.disk_sectors_written, to_com);
+    kstats_line("bios_calls", bios_disk_calls, to_com);
+    kstats_line("retries", bios_disk_retries + fdc_retries, to_com);
+    kstats_line("cache_hits", cache_hits, to_com);
+    kstats_line("cache_misses", cache_misses, to_com);
+    kstats_line("ramdisk_sectors", kstats.ramdisk_sectors, to_com);
+    kstats_line("bytes_printed", kstats.bytes_printed, to_com);
+}
+
+// RAM disk: 'mount -r' copies the volume to extended memory at 1 MB, and
+// sectors below `ramdisk_sectors` are then read from there with INT 15h
+// AH=87h block moves instead of from the drive. With too little extended
+// memory only the start of the volume (FAT, root directory, first files)
+// is copied and the rest still comes through the track cache. Writes go
+// to both, so the copy stays current and 'sync' works as before.
+#define RAMDISK_BASE        0x100000UL
+#define RAMDISK_MOVE_SECTORS 64          // 32 KB per block move
+
+// Descriptor table for AH=87h: the BIOS fills in all but source and target
+struct __attribute__((packed)) move_desc {
+    uint16_t limit;
+    uint16_t base_lo;
+    uint8_t  base_hi;
+    uint8_t  access;
+    uint16_t reserved;
+};
+
+static struct move_desc move_gdt[6];
+static unsigned short ext_mem_kb;            // INT 15h AH=88h at boot
+static unsigned int ramdisk_sectors;         // Resident, 0 when off
+static uint32_t ramdisk_load_us;
+static uint32_t ramdisk_reads, ramdisk_writes;
+
+static uint32_t far_linear(farptr_t p) {
+    return ((uint32_t)FAR_SEG(p) << 4) + FAR_OFF(p);
+}
+
+static void move_desc_set(struct move_desc *d, uint32_t base) {
+    d->limit = 0xFFFF;
+    d->base_lo = (uint16_t)base;
+    d->base_hi = (uint8_t)(base >> 16);
+    d->access = 0x93;                        // Present, data, writable
+    d->reserved = 0;
+}
+
+// Copy `words` (at most 0x8000) between two linear addresses
+static int ext_move(uint32_t dst, uint32_t src, unsigned short words) {
+    unsigned short err;
+
+    move_desc_set(&move_gdt[2], src);
+    move_desc_set(&move_gdt[3], dst);
+    __asm__ __volatile__("pushw %%es\n\tpushw %%ds\n\tpopw %%es\n\t"
+                         "movb $0x87, %%ah\n\tclc\n\tint $0x15\n\tsbb %0, %0\n\tpopw %%es"
+                         : "=r"(err) : "S"(move_gdt), "c"(words) : "ax", "cc", "memory");
+    return err ? -1 : 0;
+}
+
+// Move `count` sectors between the RAM disk at `lba` and `buffer`
+static int ramdisk_transfer(unsigned int lba, unsigned int count, farptr_t buffer,
+                            unsigned char write) {
+    while (count) {
+        unsigned int n = count > RAMDISK_MOVE_SECTORS ? RAMDISK_MOVE_SECTORS : count;
+        uint32_t ram = RAMDISK_BASE + ((uint32_t)lba << 9);
+        uint32_t mem = far_linear(buffer);
+
+        if (ext_move(write ? ram : mem, write ? mem : ram, n * 256)) return -1;
+        lba += n;
+        count -= n;
+        buffer = FAR_ADD_SECTORS(buffer, n);
+    }
+    return 0;
+}
+
+// Disk hooks for fat12.c
 
-static void com1_putc(char c) {
-    while (!(inb(COM1_LSR) & 0x20)); // Wait for THR empty
-    outb(COM1_DATA, c);
+// Through INT 13h whatever the backend, as the FDC's data rate comes from
+// the geometry this sector describes. A seek-ahead from before a 'mount -b'
+// may still be pending, so release the FDC either way.
+int disk_read_boot_sector(unsigned char drive, void *buf) {
+    fdc_release();
+    return bios_read_sector(drive, 0, 0, 1, buf) ? -1 : 0;
 }
 
-static void com1_newline(void) {
-    com1_putc('\r');
-    com1_putc('\n');
-}
+// Read `count` consecutive sectors starting at `lba`: what the RAM disk
+// holds from there, the rest through the track cache
+int disk_read_sectors(unsigned int lba, unsigned int count, farptr_t buffer) {
+    struct chs_cursor pos;
+    kstats.sectors_read += count;
+
+    if (lba < ramdisk_sectors) {
+        unsigned int n = ramdisk_sectors - lba < count ? ramdisk_sectors - lba : count;
+        if (ramdisk_transfer(lba, n, buffer, 0)) return -1;
+        ramdisk_reads++;
+        kstats.ramdisk_sectors += n;
+        lba += n;
+        count -= n;
+        buffer = FAR_ADD_SECTORS(buffer, n);
+    }
+
+    chs_seek(&disk_geom, &pos, lba);
 
+    while (count > 0) {
+        // Everything up to the end of this track comes from one slot
+        unsigned int run = disk_geom.sectors_per_track - (pos.sector - 1);
+        if (run > count) run = count;
 
-static void com1_puts(const char *s) {
-    while (*s) {
-        com1_putc(*s++);
+        if (disk_cache_read(disk_geom.drive, pos.cyl, pos.head, pos.sector, run, buffer)) {
+            return -1;
+        }
+
+        count -= run;
+        buffer = FAR_ADD_SECTORS(buffer, run);
+        chs_advance(&disk_geom, &pos, run);
     }
+    return 0;
 }
 
-static void bios_putc(char c) {
-    __asm__ __volatile__ (
-        "movb $0x0E, %%ah \n\t"
-        "movb %0, %%al    \n\t"
-        "int  $0x10       \n\t"
-        :
-        : "r"(c)
-        : "ax"
-    );
-}
+// Write `count` consecutive sectors starting at `lba` into the track cache;
+// they reach the drive on eviction or disk_sync. The RAM disk copy, if
+// any, is updated right away.
+int disk_write_sectors(unsigned int lba, unsigned int count, farptr_t buffer) {
+    struct chs_cursor pos;
+    chs_seek(&disk_geom, &pos, lba);
+    kstats.sectors_written += count;
+
+    if (lba < ramdisk_sectors) {
+        unsigned int n = ramdisk_sectors - lba < count ? ramdisk_sectors - lba : count;
+        if (ramdisk_transfer(lba, n, buffer, 1)) return -1;
+        ramdisk_writes++;
+    }
 
-static void bios_puts(const char* s) {
-    while (*s) bios_putc(*s++);
-}
+    while (count > 0) {
+        unsigned int run = disk_geom.sectors_per_track - (pos.sector - 1);
+        if (run > count) run = count;
 
-static void bios_newline(void) {
-    bios_putc('\r');
-    bios_putc('\n');
-}
+        if (disk_cache_write(disk_geom.drive, pos.cyl, pos.head, pos.sector, run, buffer)) {
+            return -1;
+        }
 
-static unsigned char bios_getkey(void) {
-    unsigned char ch;
-    __asm__ __volatile__ (
-        "xor %%ah, %%ah \n\t"  // AH=0
-        "int $0x16      \n\t"  // BIOS keyboard service
-        "mov %%al, %0   \n\t"  // return ASCII in ch
-        : "=r"(ch)
-        :
-        : "ax"
-    );
-    return ch;
+        count -= run;
+        buffer = FAR_ADD_SECTORS(buffer, run);
+        chs_advance(&disk_geom, &pos, run);
+    }
+    return 0;
 }
 
-void read_command(char *buf, unsigned int maxlen) {
-    unsigned int i = 0;
-
-    while (i < maxlen - 1) {
-        unsigned char c = bios_getkey();
+// Size the track cache and the controller for a newly mounted volume; a
+// RAM disk of the previous one is dropped
+void disk_configure(const struct disk_geometry *geom) {
+    ramdisk_sectors = 0;
+    disk_cache_configure(geom->sectors_per_track);
+    fdc_configure();
+}
 
-        if (c == '\r') {            // Enter
-            break;
-        } else if (c == 0x08) {     // Backspace
-            if (i > 0) {
-                i--;                        // remove from buffer
-                bios_putc(0x08);            // move cursor back
-                bios_putc(' ');             // overwrite with space
-                bios_putc(0x08);            // move cursor back again
-            }
-        } else {
-            buf[i++] = c;           // add to buffer
-            bios_putc(c);           // echo
+// Copy the mounted volume to the RAM disk a track at a time through
+// `track`, a one-track buffer, as much of it as extended memory holds.
+// Returns the sectors now resident.
+static unsigned int ramdisk_load(farptr_t track) {
+    unsigned int spt = disk_geom.sectors_per_track;
+    unsigned int total = disk_geom.total_sectors;
+    uint32_t started = timer_us();
+
+    ramdisk_sectors = 0;
+    ramdisk_reads = ramdisk_writes = 0;
+    if ((uint32_t)ext_mem_kb * 2 < total) total = ext_mem_kb * 2;
+    if (!total || !track) return 0;
+
+    for (unsigned int lba = 0; lba < total; lba += spt) {
+        unsigned int n = total - lba < spt ? total - lba : spt;
+        if (disk_read_sectors(lba, n, track) || ramdisk_transfer(lba, n, track, 1)) {
+            ramdisk_sectors = 0;
+            return 0;
         }
     }
+    ramdisk_sectors = total;
+    ramdisk_load_us = timer_us() - started;
+    return total;
+}
 
-    buf[i] = 0; // null-terminate
-    bios_newline(); // move to next line after Enter
+static void ramdisk_stat(void) {
+    console_puts("Extended RAM: ");
+    console_putdec(ext_mem_kb);
+    console_puts(" KB");
+    console_newline();
+    if (!ramdisk_sectors) {
+        console_puts("RAM disk off, 'mount -r' to load it");
+        console_newline();
+        return;
+    }
+    console_puts("Resident: ");
+    console_putdec((uint32_t)ramdisk_sectors << 9);
+    console_puts(" of ");
+    console_putdec((uint32_t)disk_geom.total_sectors << 9);
+    console_puts(" bytes at 1 MB, loaded in ");
+    console_putdec(udiv32_16(ramdisk_load_us, 1000, 0));
+    console_puts(" ms");
+    console_newline();
+    console_puts("Reads: ");
+    console_putdec(ramdisk_reads);
+    console_puts("  Sectors: ");
+    console_putdec(kstats.ramdisk_sectors);
+    console_puts("  Writes: ");
+    console_putdec(ramdisk_writes);
+    console_newline();
 }
 
+static unsigned int bcd_to_int(unsigned char v) {
+    return (v >> 4) * 10 + (v & 15);
+}
 
-static void bios_putdec(unsigned int val) {
-    char buf[6];
-    int i = 0;
+// DOS date and time from the RTC (INT 1Ah); 1980-01-01 00:00 without one
+void clock_dos_time(uint16_t *date, uint16_t *time) {
+    unsigned short cx, dx, err;
 
-    // handle 0 explicitly
-    if (val == 0) {
-        bios_putc('0');
-        return;
-    }
+    *date = (1 << 5) | 1;
+    *time = 0;
 
-    // convert backwards
-    while (val > 0) {
-        buf[i++] = '0' + (val % 10);
-        val /= 10;
-    }
+    __asm__ __volatile__("movb $0x04, %%ah\n\tclc\n\tint $0x1a\n\tsbb %2, %2"
+                         : "=c"(cx), "=d"(dx), "=r"(err) : : "ax", "cc");
+    if (err) return;
+    unsigned int year = bcd_to_int(cx >> 8) * 100 + bcd_to_int(cx & 0xFF);
+    if (year >= 1980) *date = ((year - 1980) << 9) | (bcd_to_int(dx >> 8) << 5) | bcd_to_int(dx & 0xFF);
 
-    // print in reverse
-    while (i--) {
-        bios_putc(buf[i]);
-    }
+    __asm__ __volatile__("movb $0x02, %%ah\n\tclc\n\tint $0x1a\n\tsbb %2, %2"
+                         : "=c"(cx), "=d"(dx), "=r"(err) : : "ax", "cc");
+    if (err) return;
+    *time = (bcd_to_int(cx >> 8) << 11) | (bcd_to_int(cx & 0xFF) << 5) | (bcd_to_int(dx >> 8) >> 1);
 }
 
-int strcmp(const char *a, const char *b) {
-    while (*a && (*a == *b)) {
-        a++;
-        b++;
-    }
-    return *(const unsigned char*)a - *(const unsigned char*)b;
+// FAT sectors for fat12.c
+static struct mem_pool sector_pool;
+
+farptr_t disk_sector_alloc(void) {
+    return pool_get(&sector_pool);
 }
 
-extern unsigned char bios_read_sector(
-    unsigned char drive,
-    unsigned char head,
-    unsigned char track,
-    unsigned char sector,
-    void* buffer
-);
+void disk_sector_free(farptr_t buf) {
+    pool_put(&sector_pool, buf);
+}
 
-static struct fat12_boot_sector boot_sector;
-static unsigned char fat_buffer[512 * 9];
-static unsigned char root_dir_buffer[512 * 14];
-static unsigned char file_buffer[512];
-static unsigned char fat12_initialized = 0;
+// Background jobs
 
-// Helper function to read the FAT12 boot sector from floppy A:
-static int fat12_read_boot_sector(void) {
-    if (bios_read_sector(FLOPPY_DRIVE_A, 0, 0, 1, &boot_sector)) {
-        return -1;
-    }
-    return 0;
-}
+// After 'mount' and 'ls': finish the root index and the FAT, then load the
+// tracks holding the first cluster of the files 'ls' showed, leaving one
+// cache slot to whatever the next command needs
+#define PREFETCH_FILES 8
 
-// Helper function to read the FAT from floppy A:
-static int fat12_read_fat(void) {
-    struct fat12_boot_sector *bs = &boot_sector;
-    unsigned int fat_start_sector = bs->reserved_sectors;
+static struct job *prefetch_job;
+static unsigned short prefetch_clusters[PREFETCH_FILES];
+static unsigned int prefetch_count, prefetch_pos, prefetch_budget;
 
-    for (unsigned int i = 0; i < bs->sectors_per_fat; i++) {
-        unsigned int lba = fat_start_sector + i;
-        unsigned char cyl = lba / (bs->sectors_per_track * bs->num_heads);
-        unsigned char temp = lba % (bs->sectors_per_track * bs->num_heads);
-        unsigned char head = temp / bs->sectors_per_track;
-        unsigned char sector = (temp % bs->sectors_per_track) + 1;
+static void prefetch_listing(unsigned short dir) {
+    unsigned int slot = 0;
+    struct fat12_dir_entry *entry;
 
-        if (bios_read_sector(FLOPPY_DRIVE_A, head, cyl, sector, &fat_buffer[i * 512])) {
-            return -1;
+    prefetch_count = prefetch_pos = 0;
+    while (prefetch_count < PREFETCH_FILES && (entry = fat12_dir_next(dir, &slot))) {
+        if (!(entry->attr & 0x10) && entry->size && entry->start_cluster >= 2) {
+            prefetch_clusters[prefetch_count++] = entry->start_cluster;
         }
     }
-    return 0;
+    prefetch_budget = track_cache_slots > 1 ? track_cache_slots - 1 : 0;
+    job_wake(prefetch_job);
 }
 
-// Helper function to read root directory from floppy A:
-static int fat12_read_root_dir(void) {
-    struct fat12_boot_sector *bs = &boot_sector;
-    unsigned int root_start = bs->reserved_sectors + (bs->num_fats * bs->sectors_per_fat);
-    unsigned int root_sectors = (bs->root_entries * 32) / bs->bytes_per_sector;
-
-    for (unsigned int i = 0; i < root_sectors; i++) {
-        unsigned int lba = root_start + i;
-        unsigned char cyl = lba / (bs->sectors_per_track * bs->num_heads);
-        unsigned char temp = lba % (bs->sectors_per_track * bs->num_heads);
-        unsigned char head = temp / bs->sectors_per_track;
-        unsigned char sector = (temp % bs->sectors_per_track) + 1;
+static int job_prefetch(struct job *j) {
+    (void)j;
+    if (fat12_prefetch_step()) return 1;
 
-        if (bios_read_sector(FLOPPY_DRIVE_A, head, cyl, sector, &root_dir_buffer[i * 512])) {
-            return -1;
+    while (prefetch_pos < prefetch_count && prefetch_budget) {
+        unsigned int lba = fat12_cluster_lba(prefetch_clusters[prefetch_pos++]);
+        if (lba >= ramdisk_sectors && disk_prefetch(lba)) {
+            prefetch_budget--;
+            return 1;                // One track per step
         }
     }
     return 0;
 }
 
-static unsigned short fat12_get_next_cluster(unsigned short cluster) {
-    unsigned int fat_offset = cluster + (cluster / 2);  // cluster * 1.5
-
-    // Fix: Use memcpy or manual byte access to avoid strict-aliasing
-    unsigned short next_cluster;
-    unsigned char *ptr = &fat_buffer[fat_offset];
-    next_cluster = ptr[0] | (ptr[1] << 8);  // Manual little-endian read
-
-    if (cluster & 1) {
-        next_cluster >>= 4;  // Odd cluster, use high 12 bits
-    } else {
-        next_cluster &= 0x0FFF;  // Even cluster, use low 12 bits
+// Re-arm the THRE interrupt while TX data is queued, in case an interrupt
+// was lost and the ring stalled
+static int job_com(struct job *j) {
+    (void)j;
+    if (com_installed && com_tx_head != com_tx_tail) {
+        __asm__ __volatile__("cli");
+        com_ier |= 0x02;
+        outb(COM1_IER, com_ier);
+        __asm__ __volatile__("sti");
     }
-
-    return next_cluster;
+    return 0;
 }
 
-// Convert 8.3 filename to padded format (keep as-is)
-static void format_filename(const char *input, char *output) {
-    int i, j;
+// Once a second: the load over the last second, for 'jobs'
+static uint32_t load_prev_us, load_prev_halted;
+static unsigned int load_percent;
 
-    for (i = 0; i < 11; i++) {
-        output[i] = ' ';
-    }
-    output[11] = 0;
+static int job_stats(struct job *j) {
+    (void)j;
+    uint32_t now = timer_us();
+    uint32_t elapsed = now - load_prev_us;
+    uint32_t halted = idle_halted_us - load_prev_halted;
 
-    for (i = 0; i < 8 && input[i] && input[i] != '.'; i++) {
-        output[i] = input[i];
-        if (output[i] >= 'a' && output[i] <= 'z') {
-            output[i] -= 32;
-        }
+    if (elapsed >= 100 && halted <= elapsed) {
+        load_percent = 100 - udiv32(halted, udiv32_16(elapsed, 100, 0), 0);
     }
+    load_prev_us = now;
+    load_prev_halted = idle_halted_us;
+    return 0;
+}
 
-    const char *ext = input;
-    while (*ext && *ext != '.') ext++;
-    if (*ext == '.') {
-        ext++;
-        for (j = 0; j < 3 && ext[j]; j++) {
-            output[8 + j] = ext[j];
-            if (output[8 + j] >= 'a' && output[8 + j] <= 'z') {
-                output[8 + j] -= 32;
-            }
-        }
-    }
+static void jobs_init(void) {
+    prefetch_job = job_add("prefetch", job_prefetch, 0);
+    job_add("com", job_com, 100);
+    job_add("stats", job_stats, 1000);
+    sched_since_us = load_prev_us = timer_us();
 }
 
-static void fat12_list_files(void) {
-    if (!fat12_initialized) {
-        bios_puts("Error: FAT12 not mounted! Use 'mount' first.");
-        bios_newline();
-        return;
+// Job states and their share of the time since boot
+static void jobs_stat(void) {
+    uint32_t elapsed = udiv32_16(timer_us() - sched_since_us, 100, 0);   // 1% units
+    if (!elapsed) elapsed = 1;
+
+    console_puts("Background jobs ");
+    console_puts(jobs_enabled ? "on" : "off");
+    console_newline();
+    for (unsigned int i = 0; i < job_count; i++) {
+        struct job *j = &jobs[i];
+        console_puts(j->name);
+        console_puts(j->state == JOB_READY ? ": ready" : ": sleeping");
+        console_puts("  Steps: ");
+        console_putdec(j->steps);
+        console_puts("  Time: ");
+        console_putdec(j->us);
+        console_puts(" us  CPU: ");
+        console_putdec(udiv32(j->us, elapsed, 0));
+        console_puts("%");
+        console_newline();
     }
+    console_puts("Halted: ");
+    console_putdec(udiv32(idle_halted_us, elapsed, 0));
+    console_puts("%  Load last second: ");
+    console_putdec(load_percent);
+    console_puts("%");
+}
 
-    struct fat12_boot_sector *bs = &boot_sector;
-    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+int split_command_arg(char *input, char **cmd, char **arg) {
+    // skip leading spaces
+    while (*input == ' ' || *input == '\t') input++;
 
-    bios_puts("Files on A:");
-    bios_newline();
+    *cmd = input;
 
-    unsigned int file_count = 0;
+    while (*input && *input != ' ' && *input != '\t') input++;
 
-    for (unsigned int i = 0; i < bs->root_entries; i++) {
-        struct fat12_dir_entry *entry = &entries[i];
+    if (*input) {
+        *input = 0;
+        input++;
 
-        // CRITICAL: Check for end of directory FIRST
-        if (entry->name[0] == 0x00) {
-            break;  // End of directory - stop immediately
-        }
+        while (*input == ' ' || *input == '\t') input++;
 
-        // Skip deleted files
-        if ((unsigned char)entry->name[0] == 0xE5) {
-            continue;
+        if (*input) {
+            *arg = input;
+            return 1;
         }
+    }
 
-        // Skip volume labels
-        if (entry->attr & 0x08) {
-            continue;
-        }
+    *arg = "";
+    return 0;
+}
 
-        // Skip entries with invalid attributes (like 0x0F for LFN)
-        if (entry->attr == 0x0F) {
-            continue;  // Long filename entry
-        }
+// Kernel services for apps through INT 60h. AH selects the function;
+// results come back in registers, with CF set on failure. Buffers are far
+// pointers into the app's segment and are filled in place.
+#define SYSCALL_VECTOR  0x60
+#define SYSCALL_VERSION 0x0101       // 1.1, returned by SYS_VERSION
+#define SYSCALL_FILES   4            // Open files per app
 
-        // Additional validation: check if name has printable characters
-        int valid = 0;
-        for (int j = 0; j < 8; j++) {
-            unsigned char c = entry->name[j];
-            // Check for printable ASCII or space
-            if ((c >= 0x20 && c <= 0x7E) || c == 0x05) {
-                valid = 1;
-                break;
-            }
-        }
+#define FLAG_CF 0x0001
 
-        if (!valid) {
-            continue;  // Skip entries with non-printable names
-        }
+struct syscall_regs {
+    uint16_t di, si, bp, sp, bx, dx, cx, ax;
+    uint16_t es, ds;
+    uint16_t ip, cs, flags;
+};
 
-        file_count++;
+struct syscall {
+    const char *name;
+    void (*fn)(struct syscall_regs *r);
+};
 
-        // Print filename (handle 0x05 special case - should be 0xE5)
-        for (int j = 0; j < 8; j++) {
-            unsigned char c = entry->name[j];
-            if (c == ' ') break;
-            if (c == 0x05) c = 0xE5;  // Special case for Japanese characters
-            bios_putc(c);
-        }
+extern void isr_syscall(void);
 
-        // Print extension if present
-        if (entry->ext[0] != ' ' && entry->ext[0] != 0) {
-            bios_putc('.');
-            for (int j = 0; j < 3; j++) {
-                unsigned char c = entry->ext[j];
-                if (c == ' ' || c == 0) break;
-                bios_putc(c);
-            }
-        }
+static struct fat12_file syscall_files[SYSCALL_FILES];
+static unsigned char syscall_file_open[SYSCALL_FILES];
+static farptr_t syscall_old_vector;
 
-        // Print info
-        if (entry->attr & 0x10) {
-            bios_puts(" <DIR>");
-        } else {
-            bios_puts(" ");
-            bios_putdec(entry->size);
-            bios_puts(" bytes");
-        }
+static unsigned short bios_kbd_poll(void) {
+    unsigned short key, flags;
+    __asm__ __volatile__("movb $0x01, %%ah\n\tint $0x16\n\tpushf\n\tpop %1"
+                         : "=a"(key), "=r"(flags) : : "cc");
+    if (flags & 0x40) return 0;      // ZF: buffer empty
+    __asm__ __volatile__("xorb %%ah, %%ah\n\tint $0x16" : "=a"(key) : : "cc");
+    return key;
+}
 
-        bios_newline();
+static void sys_version(struct syscall_regs *r);
+
+// DS:SI = text, CX = length; AX = bytes written
+static void sys_console_write(struct syscall_regs *r) {
+    char chunk[128];
+    farptr_t src = MK_FAR(r->ds, r->si);
+    unsigned int left = r->cx;
+
+    console_sync();                  // The app may have used the BIOS
+    while (left) {
+        unsigned int n = left > sizeof(chunk) ? sizeof(chunk) : left;
+        far_memcpy(near_to_far(chunk), src, n);
+        console_write(chunk, n);
+        src += n;
+        left -= n;
     }
+    console_flush();
+    r->ax = r->cx;
+}
 
-    bios_newline();
-    bios_putdec(file_count);
-    bios_puts(" file(s)");
-    bios_newline();
+// AX = key (ASCII low, scan code high); waits in HLT
+static void sys_kbd_get(struct syscall_regs *r) {
+    unsigned short key;
+    while (!(key = bios_kbd_poll())) {
+        __asm__ __volatile__("sti\n\thlt");
+    }
+    r->ax = key;
 }
 
-// FIXED: Initialize FAT12 with proper error handling
-static int fat12_init(void) {
-    bios_puts("Mounting A:...");
-    bios_newline();
+// AX = key, or 0 if none is waiting
+static void sys_kbd_poll(struct syscall_regs *r) {
+    r->ax = bios_kbd_poll();
+}
 
-    if (fat12_read_boot_sector()) {
-        bios_puts("Error: Cannot read boot sector!");
-        bios_newline();
-        fat12_initialized = 0;
-        return -1;
+// DS:SI = data, CX = length; AX = bytes queued
+static void sys_com_write(struct syscall_regs *r) {
+    char chunk[128];
+    farptr_t src = MK_FAR(r->ds, r->si);
+    unsigned int left = r->cx;
+    unsigned int queued = 0;
+
+    while (left) {
+        unsigned int n = left > sizeof(chunk) ? sizeof(chunk) : left;
+        far_memcpy(near_to_far(chunk), src, n);
+        unsigned int sent = com_write(chunk, n);
+        queued += sent;
+        if (sent < n) break;         // TX ring full
+        src += n;
+        left -= n;
     }
+    r->ax = queued;
+}
 
-    // Validate it's a proper FAT12 floppy
-    if (boot_sector.bytes_per_sector != 512) {
-        bios_puts("Error: Invalid sector size!");
-        bios_newline();
-        fat12_initialized = 0;
-        return -1;
+// ES:DI = buffer, CX = size; AX = bytes received
+static void sys_com_read(struct syscall_regs *r) {
+    char chunk[128];
+    farptr_t dst = MK_FAR(r->es, r->di);
+    unsigned int left = r->cx;
+    unsigned int got = 0;
+
+    while (left) {
+        unsigned int n = com_read(chunk, left > sizeof(chunk) ? sizeof(chunk) : left);
+        if (!n) break;
+        far_memcpy(dst, near_to_far(chunk), n);
+        dst += n;
+        got += n;
+        left -= n;
     }
+    r->ax = got;
+}
 
-    if (fat12_read_fat()) {
-        bios_puts("Error: Cannot read FAT!");
-        bios_newline();
-        fat12_initialized = 0;
-        return -1;
+// Copy the NUL-terminated 8.3 name at DS:SI into `name` (13 bytes)
+static void syscall_name(struct syscall_regs *r, char *name) {
+    far_memcpy(near_to_far(name), MK_FAR(r->ds, r->si), 12);
+    name[12] = 0;
+}
+
+// First free handle, SYSCALL_FILES if none
+static unsigned int syscall_free_handle(void) {
+    unsigned int h;
+    for (h = 0; h < SYSCALL_FILES && syscall_file_open[h]; h++) {
     }
+    return h;
+}
 
-    if (fat12_read_root_dir()) {
-        bios_puts("Error: Cannot read root directory!");
-        bios_newline();
-        fat12_initialized = 0;
-        return -1;
+// DS:SI = NUL-terminated 8.3 name; BX = handle, DX:AX = size
+static void sys_open(struct syscall_regs *r) {
+    char name[13];
+    struct fat12_dir_entry *entry;
+    unsigned int h = syscall_free_handle();
+
+    syscall_name(r, name);
+    if (h == SYSCALL_FILES || !fat12_initialized || !(entry = fat12_find_file(name)) ||
+        fat12_open(entry, &syscall_files[h])) {
+        r->flags |= FLAG_CF;
+        return;
     }
 
-    fat12_initialized = 1;
-    bios_puts("A: mounted successfully!");
-    bios_newline();
+    syscall_file_open[h] = 1;
+    r->bx = h;
+    r->ax = (uint16_t)entry->size;
+    r->dx = (uint16_t)(entry->size >> 16);
+}
+
+// 1 if a handle is open on the root entry `entry`
+static int syscall_file_busy(const struct fat12_dir_entry *entry) {
+    struct fat12_file probe;
+
+    if (fat12_open(entry, &probe)) return 0;
+    fat12_close(&probe);
+    if (probe.dir_slot == 0xFFFF) return 0;
+    for (unsigned int h = 0; h < SYSCALL_FILES; h++) {
+        if (syscall_file_open[h] && syscall_files[h].dir_slot == probe.dir_slot) return 1;
+    }
     return 0;
 }
 
-static struct fat12_dir_entry* fat12_find_file(const char *filename) {
-    if (!fat12_initialized) return 0;
+static struct fat12_file *syscall_file(struct syscall_regs *r) {
+    if (r->bx >= SYSCALL_FILES || !syscall_file_open[r->bx]) return 0;
+    return &syscall_files[r->bx];
+}
 
-    char formatted[12];
-    format_filename(filename, formatted); // Produces 8+3 padded string
+// BX = handle, ES:DI = buffer, CX = size; AX = bytes read (0 at end)
+static void sys_read(struct syscall_regs *r) {
+    struct fat12_file *f = syscall_file(r);
+    long n;
 
-    struct fat12_dir_entry *entries = (struct fat12_dir_entry*)root_dir_buffer;
+    if (!f || (n = fat12_read_far(f, MK_FAR(r->es, r->di), r->cx)) < 0) {
+        r->flags |= FLAG_CF;
+        return;
+    }
+    r->ax = n;
+}
 
-    for (unsigned int i = 0; i < boot_sector.root_entries; i++) {
-        struct fat12_dir_entry *entry = &entries[i];
+// BX = handle
+static void sys_close(struct syscall_regs *r) {
+    struct fat12_file *f = syscall_file(r);
 
-        if (entry->name[0] == 0x00) break;   // End of directory
-        if ((unsigned char)entry->name[0] == 0xE5) continue; // Deleted
-        if (entry->attr & 0x08) continue;   // Volume label
-        if (entry->attr == 0x0F) continue;  // LFN entry
+    if (!f) {
+        r->flags |= FLAG_CF;
+        return;
+    }
+    fat12_close(f);
+    syscall_file_open[r->bx] = 0;
+}
 
-        // Compare name ignoring trailing spaces
-        int match = 1;
-        for (int j = 0; j < 8; j++) {
-            unsigned char a = entry->name[j];
-            unsigned char b = formatted[j];
+// CX = slot to start from (0 first), ES:DI = 32-byte buffer for the next
+// file's root directory entry; CX = slot to continue from. CF at the end.
+static void sys_readdir(struct syscall_regs *r) {
+    unsigned int slot = r->cx;
+    struct fat12_dir_entry *entry = fat12_initialized ? fat12_dir_next(0, &slot) : 0;
 
-            // Treat spaces as "padding"
-            if (a == ' ') a = 0;
-            if (b == ' ') b = 0;
+    if (!entry) {
+        r->flags |= FLAG_CF;
+        return;
+    }
+    far_memcpy(MK_FAR(r->es, r->di), near_to_far(entry), sizeof(*entry));
+    r->cx = slot;
+}
 
-            if (a != b) {
-                match = 0;
-                break;
-            }
-        }
+// DX:AX = microseconds from the kernel clock
+static void sys_ticks(struct syscall_regs *r) {
+    uint32_t us = timer_us();
+    r->ax = (uint16_t)us;
+    r->dx = (uint16_t)(us >> 16);
+}
 
-        // Compare extension ignoring trailing spaces
-        if (match) {
-            for (int j = 0; j < 3; j++) {
-                unsigned char a = entry->ext[j];
-                unsigned char b = formatted[8 + j];
+// DS:SI = NUL-terminated 8.3 name; BX = handle. An existing file is
+// truncated to 0 bytes, as with DOS function 3Ch, unless another handle
+// has it open.
+static void sys_create(struct syscall_regs *r) {
+    char name[13];
+    struct fat12_dir_entry *entry;
+    unsigned int h = syscall_free_handle();
+
+    syscall_name(r, name);
+    if (h == SYSCALL_FILES || !fat12_initialized) {
+        r->flags |= FLAG_CF;
+        return;
+    }
+    entry = fat12_find_file(name);
+    if (!entry) {
+        entry = fat12_create(name);
+    } else if (syscall_file_busy(entry) || fat12_truncate(entry, 0)) {
+        entry = 0;
+    }
+    if (!entry || fat12_open(entry, &syscall_files[h])) {
+        r->flags |= FLAG_CF;
+        return;
+    }
 
-                if (a == ' ') a = 0;
-                if (b == ' ') b = 0;
+    syscall_file_open[h] = 1;
+    r->bx = h;
+}
 
-                if (a != b) {
-                    match = 0;
-                    break;
-                }
-            }
-        }
+// BX = handle, DS:SI = data, CX = length; AX = bytes written. Data always
+// goes to the end of the file; the read position is kept.
+static void sys_write(struct syscall_regs *r) {
+    struct fat12_file *f = syscall_file(r);
+    long n;
+
+    if (!f || (n = fat12_write(f, MK_FAR(r->ds, r->si), r->cx)) < 0) {
+        r->flags |= FLAG_CF;
+        return;
+    }
+    r->ax = n;
+}
 
-        if (match) return entry;
+// DS:SI = NUL-terminated 8.3 name; refused while a handle has it open
+static void sys_delete(struct syscall_regs *r) {
+    char name[13];
+    struct fat12_dir_entry *entry;
+
+    syscall_name(r, name);
+    if (!fat12_initialized || ((entry = fat12_find_file(name)) && syscall_file_busy(entry)) ||
+        fat12_delete(name)) {
+        r->flags |= FLAG_CF;
     }
+}
 
-    return 0; // Not found
+// Write every pending change to the disk
+static void sys_sync(struct syscall_regs *r) {
+    if (fat12_sync()) r->flags |= FLAG_CF;
 }
 
-static int fat12_read_cluster(unsigned short cluster, void *buffer) {
-    if (!fat12_initialized) return -1;
+// Function table, indexed by AH. Append only: numbers are the ABI.
+static const struct syscall syscall_table[] = {
+    { "version",   sys_version },
+    { "con_write", sys_console_write },
+    { "kbd_get",   sys_kbd_get },
+    { "kbd_poll",  sys_kbd_poll },
+    { "com_write", sys_com_write },
+    { "com_read",  sys_com_read },
+    { "open",      sys_open },
+    { "read",      sys_read },
+    { "close",     sys_close },
+    { "readdir",   sys_readdir },
+    { "ticks",     sys_ticks },
+    { "create",    sys_create },
+    { "write",     sys_write },
+    { "delete",    sys_delete },
+    { "sync",      sys_sync },
+};
 
-    unsigned int first_data_sector =
-    boot_sector.reserved_sectors + (boot_sector.num_fats * boot_sector.sectors_per_fat) +
-    ((boot_sector.root_entries * 32) / boot_sector.bytes_per_sector);
+#define SYSCALL_COUNT (sizeof(syscall_table) / sizeof(syscall_table[0]))
 
-    unsigned int sector = first_data_sector + (cluster - 2) * boot_sector.sectors_per_cluster;
+static uint32_t syscall_calls[SYSCALL_COUNT];
 
-    for (unsigned int i = 0; i < boot_sector.sectors_per_cluster; i++) {
-        unsigned int lba = sector + i;
-        unsigned char cyl = lba / (boot_sector.sectors_per_track * boot_sector.num_heads);
-        unsigned char temp = lba % (boot_sector.sectors_per_track * boot_sector.num_heads);
-        unsigned char head = temp / boot_sector.sectors_per_track;
-        unsigned char sec = (temp % boot_sector.sectors_per_track) + 1;
+// AX = version, BX = number of functions
+static void sys_version(struct syscall_regs *r) {
+    r->ax = SYSCALL_VERSION;
+    r->bx = SYSCALL_COUNT;
+}
 
-        if (bios_read_sector(FLOPPY_DRIVE_A, head, cyl, sec, (unsigned char*)buffer + i * 512)) {
-            return -1;
-        }
+void syscall_dispatch(struct syscall_regs *r) {
+    unsigned int fn = r->ax >> 8;
+
+    r->flags &= ~FLAG_CF;
+    if (fn >= SYSCALL_COUNT) {
+        r->flags |= FLAG_CF;
+        return;
     }
-    return 0;
+    syscall_calls[fn]++;
+    syscall_table[fn].fn(r);
 }
 
-static int fat12_read_file(const char *filename, void *buffer, unsigned int max_size) {
-    struct fat12_dir_entry *file = fat12_find_file(filename);
-    if (!file) return -1;
+static void syscall_install(void) {
+    set_int_vector(SYSCALL_VECTOR, isr_syscall, &syscall_old_vector);
+}
 
-    unsigned int remaining = file->size;
-    unsigned short cluster = file->start_cluster;
-    unsigned char *buf = (unsigned char*)buffer;
+// Restore the vector and close whatever the app left open
+static void syscall_remove(void) {
+    restore_int_vector(SYSCALL_VECTOR, syscall_old_vector);
+    for (unsigned int h = 0; h < SYSCALL_FILES; h++) {
+        if (syscall_file_open[h]) fat12_close(&syscall_files[h]);
+        syscall_file_open[h] = 0;
+    }
+}
 
-    while (cluster < 0xFF8) { // FAT12 end-of-chain >= 0xFF8
-        if (remaining == 0) break;
+static void syscall_stat(void) {
+    for (unsigned int i = 0; i < SYSCALL_COUNT; i++) {
+        console_puts(syscall_table[i].name);
+        console_puts(": ");
+        console_putdec(syscall_calls[i]);
+        console_newline();
+    }
+}
 
-        unsigned int to_read = remaining > boot_sector.bytes_per_sector * boot_sector.sectors_per_cluster ?
-        boot_sector.bytes_per_sector * boot_sector.sectors_per_cluster : remaining;
+// Executable header. The image (code, then data) follows the header and
+// the relocation table, which together take `header_paras` paragraphs.
+// Each relocation is the image offset of a word that gets the load segment
+// added to it. Code, data, BSS and stack share one segment: CS = DS = SS.
+struct __attribute__((packed)) app_header {
+    uint16_t magic;                  // APP_MAGIC
+    uint16_t header_paras;           // Header + relocation table, in paragraphs
+    uint16_t code_size;
+    uint16_t data_size;
+    uint16_t bss_size;               // Zeroed at load, not stored in the file
+    uint16_t entry;                  // Far-called, returns with RETF
+    uint16_t stack_size;             // Stack sits above the BSS
+    uint16_t reloc_count;            // Words following the header
+};
 
-        if (to_read > max_size) return -1; // Buffer too small
+extern unsigned short app_enter(unsigned short seg, unsigned short entry,
+                                unsigned short sp, unsigned short near_ret);
 
-        if (fat12_read_cluster(cluster, buf)) return -1;
+// Top of conventional memory, in paragraphs
+static unsigned short mem_top_seg(void) {
+    unsigned short kb;
+    __asm__ __volatile__("int $0x12" : "=a"(kb) : : );
+    return kb * 64;
+}
 
-        buf += to_read;
-        remaining -= to_read;
-        max_size -= to_read;
+// Per-command scratch, released by the shell after every command
+static struct mem_arena scratch;
+
+// `base` holds the header as loaded, `seg` the image after it. Every
+// relocated word must lie within the image, or the table would patch other
+// heap blocks.
+static int app_relocate(unsigned short base, unsigned short seg, const struct app_header *hdr) {
+    uint16_t batch[32];
+    farptr_t table = MK_FAR(base, sizeof(*hdr));
+    unsigned int left = hdr->reloc_count;
+    uint32_t image = (uint32_t)hdr->code_size + hdr->data_size;
+
+    if (sizeof(*hdr) + (uint32_t)left * 2 > (uint32_t)hdr->header_paras * 16) return -1;
+    if (left && image < 2) return -1;
+
+    while (left) {
+        unsigned int n = left > 32 ? 32 : left;
+        far_memcpy(near_to_far(batch), table, n * 2);
+
+        for (unsigned int i = 0; i < n; i++) {
+            uint16_t word;
+            if (batch[i] > image - 2) return -1;
+            farptr_t at = MK_FAR(seg, batch[i]);
+            far_memcpy(near_to_far(&word), at, 2);
+            word += seg;
+            far_memcpy(at, near_to_far(&word), 2);
+        }
 
-        cluster = fat12_get_next_cluster(cluster);
+        table += n * 2;
+        left -= n;
     }
-
-    return file->size; // Return bytes read
+    return 0;
 }
 
-int split_command_arg(char *input, char **cmd, char **arg) {
-    // skip leading spaces
-    while (*input == ' ' || *input == '\t') input++;
+void run_app(const struct fat12_dir_entry *file) {
+    struct fat12_file f;
+    struct app_header hdr;
+    struct lz_header lzh;
+    unsigned int start;
+    unsigned short seg, entry, sp, near_ret;
+    uint32_t room;
+    farptr_t base, dst;
+    long got;
+
+    // Peek at the first chunk for a header; the full load below then
+    // comes out of the track cache. A compressed image is decoded as far
+    // as its app header. An empty file, or an empty image, is no app.
+    int packed = file->size ? lz_is_packed(file, &lzh) : -1;
+    if (packed == 1) {
+        got = lz_read_file(file, near_to_far(&hdr), sizeof(hdr));
+    } else if (packed == 0 && !fat12_open(file, &f)) {
+        got = fat12_read_chunk(&f, stream_buf[0], STREAM_CHUNK_BYTES, &start);
+        fat12_close(&f);
+        if (got > 0) far_memcpy(near_to_far(&hdr), near_to_far(stream_buf[0]), sizeof(hdr));
+    } else {
+        got = -1;
+    }
+    if (got <= 0) {
+        console_puts("Failed to load app!");
+        console_newline();
+        return;
+    }
 
-    *cmd = input;
+    // Whole clusters are transferred, so the block takes the slack too;
+    // the decoder writes exactly the image
+    uint32_t size = packed ? lzh.size : file->size;
+    uint32_t cluster_mask = disk_geom.cluster_bytes - 1;
+    uint32_t loaded = packed ? size : (size + cluster_mask) & ~cluster_mask;
+
+    if (size >= sizeof(hdr) && hdr.magic == APP_MAGIC) {
+        uint32_t image = (uint32_t)hdr.code_size + hdr.data_size;
+        uint32_t span = image + hdr.bss_size + hdr.stack_size;
+
+        if (span > 0x10000 || hdr.entry >= hdr.code_size || hdr.header_paras >= 0x1000 ||
+            size < (uint32_t)hdr.header_paras * 16 + image) {
+            console_puts("Bad app header!");
+            console_newline();
+            return;
+        }
 
-    while (*input && *input != ' ' && *input != '\t') input++;
+        // Header lands below the image, so the image starts at offset 0
+        room = (uint32_t)hdr.header_paras * 16 + span;
+        if (room < loaded) room = loaded;
+        base = arena_alloc(&scratch, room);
+        seg = FAR_SEG(base) + hdr.header_paras;
+        dst = base;
+        entry = hdr.entry;
+        sp = (uint16_t)((span + 1) & ~1UL);
+        near_ret = 0;
+    } else {
+        // A whole segment, the top 4 KB left for the stack
+        if (size > 0x10000 - APP_LEGACY_ORG - 0x1000) {
+            console_puts("App too large!");
+            console_newline();
+            return;
+        }
+        base = arena_alloc(&scratch, 0x10000);
+        room = 0x10000 - APP_LEGACY_ORG;
+        seg = FAR_SEG(base);
+        dst = MK_FAR(seg, APP_LEGACY_ORG);
+        entry = APP_LEGACY_ORG;
+        sp = 0;                      // First push lands at 0xFFFE
+        near_ret = APP_LEGACY_ORG - 1;
+    }
 
-    if (*input) {
-        *input = 0;
-        input++;
+    if (!base) {
+        console_puts("Not enough memory!");
+        console_newline();
+        return;
+    }
 
-        while (*input == ' ' || *input == '\t') input++;
+    console_puts("Loading into memory...");
+    console_newline();
 
-        if (*input) {
-            *arg = input;
-            return 1;
-        }
+    got = packed ? lz_read_file(file, dst, room) : fat12_read_file(file, dst, room);
+    if (got < 0 || (near_ret == 0 && app_relocate(FAR_SEG(base), seg, &hdr))) {
+        console_puts("Failed to load app!");
+        console_newline();
+        return;
     }
 
-    *arg = "";
-    return 0;
+    if (near_ret) {
+        unsigned char retf = 0xCB;
+        far_memcpy(MK_FAR(seg, near_ret), near_to_far(&retf), 1);
+    } else {
+        // BSS and whatever cluster slack landed there are cleared here
+        uint32_t data_end = (uint32_t)hdr.code_size + hdr.data_size;
+        uint32_t bss_words = ((uint32_t)hdr.bss_size + 1) / 2;
+        farptr_t bss = MK_FAR(seg + (uint16_t)(data_end >> 4), (uint16_t)data_end & 15);
+        if (bss_words) far_memsetw(bss, 0, (unsigned short)bss_words);
+    }
+
+    console_puts("Running app...");
+    console_newline();
+    console_newline();
+
+    console_flush();  // Apps print through the BIOS, hand over the cursor
+    kbd_shutdown();   // ...and read keys through INT 16h
+    syscall_install();
+    app_enter(seg, entry, sp, near_ret);
+    syscall_remove();
+    kbd_init();
+    console_sync();
 }
 
-typedef void (*user_app_t)(void);
+static char crlf[] = "\r\n";
 
-void run_app(const char *filename) {
-    unsigned char *app_memory = (unsigned char *)APP_LOAD_ADDR;
-    bios_puts("Loading into memory...");
-    bios_newline();
-    int size = fat12_read_file(filename, app_memory, APP_MAX_SIZE);
+// touch FILE | append FILE TEXT | trunc FILE SIZE | rm FILE. Changes stay
+// in memory and the track cache until 'sync'.
+static void file_write_command(const char *command, char *arg) {
+    char *name, *rest;
+    struct fat12_dir_entry *file;
 
-    if (size <= 0) {
-        bios_puts("Failed to load app!");
-        bios_newline();
+    if (!fat12_initialized) {
+        console_puts("Error: FAT12 not mounted! Use 'mount' first.");
+        return;
+    }
+    split_command_arg(arg, &name, &rest);
+    if (!name[0]) {
+        console_puts("Usage: touch|rm FILE, append FILE TEXT, trunc FILE SIZE");
         return;
     }
 
-    bios_puts("Running app...");
-    bios_newline();
-    bios_newline();
+    file = fat12_find_file(name);
+    if (command[0] == 'r' || (command[0] == 't' && command[1] == 'r')) {
+        if (!file) {
+            console_puts("File not found!");
+        } else if (command[0] == 'r' ? fat12_delete(name) : fat12_truncate(file, str_to_u32(rest))) {
+            console_puts("Write failed!");
+        }
+        return;
+    }
 
-    // Jump to app code
-    user_app_t app = (user_app_t)APP_LOAD_ADDR;
-    app();  // Transfer control to the app
+    if (!file && !(file = fat12_create(name))) {
+        console_puts("Cannot create file!");
+        return;
+    }
+    if (command[0] == 'a') {
+        unsigned int n = strlen(rest);
+        if (fat12_append(file, near_to_far(rest), n) != (long)n ||
+            fat12_append(file, near_to_far(crlf), 2) != 2) {
+            console_puts("Write failed!");
+        }
+    }
 }
 
+// Written by the boot loader at 0000:0600
+#define BOOT_INFO_SEG   0x0060
+#define BOOT_INFO_MAGIC 0x5442       // "BT"
+
+struct __attribute__((packed)) boot_info {
+    uint16_t magic;
+    uint32_t start_ticks;            // BIOS ticks when the loader started
+    uint32_t end_ticks;              // ...and when the kernel was in memory
+    uint16_t kernel_sectors;
+};
+
+static void print_boot_time(void) {
+    struct boot_info info;
+    far_memcpy(near_to_far(&info), MK_FAR(BOOT_INFO_SEG, 0), sizeof(info));
+    if (info.magic != BOOT_INFO_MAGIC) return;
+
+    // 18.2 ticks per second: 10000 / 182 ms each
+    uint32_t ms = udiv32_16(umul32_16(info.end_ticks - info.start_ticks, 10000), 182, 0);
+    console_puts("Kernel load: ");
+    console_putdec(info.kernel_sectors);
+    console_puts(" sectors in ");
+    console_putdec(ms);
+    console_puts(" ms");
+    console_newline();
+}
 
 void print_banner(void) {
-    bios_puts("  ____        _     _     _                  _  __                    _ ");
-    bios_newline();
-    bios_puts(" |  _ \\      | |   | |   | |                | |/ /                   | |");
-    bios_newline();
-    bios_puts(" | |_) |_   _| |__ | |__ | | ___  ___ ______| ' / ___ _ __ _ __   ___| |");
-    bios_newline();
-    bios_puts(" |  _ <| | | | '_ \\| '_ \\| |/ _ \\/ __|______|  < / _ \\ '__| '_ \\ / _ \\ |");
-    bios_newline();
-    bios_puts(" | |_) | |_| | |_) | |_) | |  __/\\__ \\      | . \\  __/ |  | | | |  __/ |");
-    bios_newline();
-    bios_puts(" |____/ \\__,_|_.__/|_.__/|_|\\___||___/      |_|\\_\\___|_|  |_| |_|\\___|_|");
-    bios_newline();
-    bios_newline();
+    console_puts("  ____        _     _     _                  _  __                    _ ");
+    console_newline();
+    console_puts(" |  _ \\      | |   | |   | |                | |/ /                   | |");
+    console_newline();
+    console_puts(" | |_) |_   _| |__ | |__ | | ___  ___ ______| ' / ___ _ __ _ __   ___| |");
+    console_newline();
+    console_puts(" |  _ <| | | | '_ \\| '_ \\| |/ _ \\/ __|______|  < / _ \\ '__| '_ \\ / _ \\ |");
+    console_newline();
+    console_puts(" | |_) | |_| | |_) | |_) | |  __/\\__ \\      | . \\  __/ |  | | | |  __/ |");
+    console_newline();
+    console_puts(" |____/ \\__,_|_.__/|_.__/|_|\\___||___/      |_|\\_\\___|_|  |_| |_|\\___|_|");
+    console_newline();
+    console_newline();
 }
 
 void kmain(void) {
     print_banner();
-    bios_newline();
-    bios_puts("CS: ");
+    console_newline();
+    console_puts("CS: ");
     unsigned short cs;
     __asm__ __volatile__("mov %%cs, %0" : "=r"(cs));
-    bios_putdec(cs);
-    bios_newline();
-    bios_puts("Conventional RAM: ");
-    unsigned short kb;
-    __asm__ __volatile__("int $0x12" : "=a"(kb) : : );
-    bios_putdec(kb);
-    bios_puts("KB");
-    bios_newline();
-    unsigned short ext_kb;
+    console_putdec(cs);
+    console_newline();
+    console_puts("Conventional RAM: ");
+    console_putdec(mem_top_seg() / 64);
+    console_puts("KB");
+    console_newline();
+    mem_init(mem_top_seg());
+    pool_init(&sector_pool, "sector", 512, FAT12_MAX_FAT_SECTORS, 0);
     __asm__ __volatile__(
         "movb $0x88, %%ah \n\t"
         "int $0x15        \n\t"
-        : "=a"(ext_kb)   // 'a' is okay for 16-bit ax in ia16-elf-gcc
+        : "=a"(ext_mem_kb)   // 'a' is okay for 16-bit ax in ia16-elf-gcc
     );
-    bios_puts("Extended RAM: ");
-    bios_putdec(ext_kb);
-    bios_puts("KB");
-    bios_newline();
+    console_puts("Extended RAM: ");
+    console_putdec(ext_mem_kb);
+    console_puts("KB");
+    console_newline();
+    print_boot_time();
+    timer_init();
+    jobs_init();
+    kbd_init();
+    if (SERIAL_CONSOLE && !com1_init(115200, 8)) console_serial = 1;
     for (;;) {
         char cmd[80];
-        bios_putc('>');
+        console_putc('>');
         read_command(cmd, sizeof(cmd));
         char *command, *arg;
         split_command_arg(cmd, &command, &arg);
-        bios_newline();
+
+        // time <command>: run it and report the elapsed time
+        unsigned char timed = 0;
+        uint32_t started = 0;
+        if (!strcmp(command, "time") && arg[0]) {
+            split_command_arg(arg, &command, &arg);
+            timed = 1;
+            started = timer_us();
+        }
+
+        console_newline();
         if (!strcmp(command, "reboot")) {
+            fat12_sync();
+            com1_shutdown();
+            kbd_shutdown();
+            timer_shutdown();
             __asm__ __volatile__("int $0x19");
         } else if (!strcmp(command, "halt")) {
-            bios_puts("Halting...");
+            console_puts("Halting...");
+            console_flush();
             for (;;) __asm__ __volatile__("hlt");
         } else if (!strcmp(command, "com")) {
-            bios_puts("Initializing COM1");
-            com1_init();
-            bios_newline();
-            bios_puts("Type !q to quit");
-            for (;;) {
-                bios_newline();
-                char cmd[80];
-                bios_puts("COM1>");
-                read_command(cmd, sizeof(cmd));
-                if (!strcmp(cmd, "!q")) {
-                    break;
+            char *baud_arg, *trigger_arg;
+            split_command_arg(arg, &baud_arg, &trigger_arg);
+            uint32_t baud = baud_arg[0] ? str_to_u32(baud_arg) : 9600;
+            unsigned char trigger = trigger_arg[0] ? str_to_int(trigger_arg) : 8;
+
+            console_puts("Initializing COM1");
+            if (com1_init(baud, trigger)) {
+                console_newline();
+                console_puts("Usage: com [baud dividing 115200] [trigger 1/4/8/14]");
+            } else {
+                console_puts(" at ");
+                console_putdec(baud);
+                console_puts(" baud");
+                console_newline();
+                console_puts("Type !q to quit");
+                idle_hook = com_echo_rx;
+                for (;;) {
+                    console_newline();
+                    char cmd[80];
+                    console_puts("COM1>");
+                    read_command(cmd, sizeof(cmd));
+                    if (!strcmp(cmd, "!q")) {
+                        break;
+                    }
+                    if (com_puts(cmd) < strlen(cmd) || com_puts("\r\n") < 2) {
+                        console_puts("TX buffer full!");
+                    } else {
+                        console_puts("Send!");
+                    }
+                }
+                idle_hook = 0;
+            }
+        } else if (!strcmp(command, "comstat")) {
+            com1_stat();
+        } else if (!strcmp(command, "serial")) {
+            if (!strcmp(arg, "off")) {
+                console_serial = 0;
+                console_puts("Serial console off");
+            } else if (com_installed || !com1_init(115200, 8)) {
+                console_serial = 1;
+                console_puts("Serial console on COM1");
+            } else {
+                console_puts("COM1 init failed!");
+            }
+        } else if (!strcmp(command, "jobs")) {
+            if (!strcmp(arg, "off") || !strcmp(arg, "on")) {
+                jobs_enabled = arg[1] == 'n';
+            }
+            jobs_stat();
+        } else if (!strcmp(command, "mem")) {
+            mem_stat();
+            pool_stat(&sector_pool);
+            pool_stat(&track_pool);
+            console_puts("Scratch: ");
+            console_putdec(scratch.high_water);
+            console_puts(" bytes at most");
+        } else if (!strcmp(command, "prof")) {
+            // prof [start [ms] | stop | dump]
+            char *sub, *rest;
+            split_command_arg(arg, &sub, &rest);
+            if (!strcmp(sub, "start")) {
+                unsigned int interval = rest[0] ? str_to_int(rest) : 1;
+                if (prof_start(interval)) {
+                    console_puts("Not enough memory!");
+                } else {
+                    console_puts("Profiling every ");
+                    console_putdec(prof_interval);
+                    console_puts(" ms");
+                }
+            } else if (!strcmp(sub, "stop")) {
+                prof_running = 0;
+                prof_stat();
+            } else if (!strcmp(sub, "dump")) {
+                if (com_installed) {
+                    prof_dump();
+                    console_puts("Sent to COM1");
+                } else {
+                    console_puts("COM1 not initialized, use 'com' first.");
+                }
+            } else if (!sub[0]) {
+                prof_stat();
+            } else {
+                console_puts("Usage: prof [start [ms] | stop | dump]");
+            }
+        } else if (!strcmp(command, "sysstat")) {
+            syscall_stat();
+        } else if (!strcmp(command, "stats")) {
+            if (!strcmp(arg, "com")) {
+                if (com_installed) {
+                    kstats_dump(1);
+                    console_puts("Sent to COM1");
+                } else {
+                    console_puts("COM1 not initialized, use 'com' first.");
                 }
-                com1_puts(cmd);
-                com1_newline();
-                bios_puts("Send!");
+            } else {
+                kstats_dump(0);
             }
         } else if (!strcmp(command, "ls")) {
-            fat12_list_files();
+            int dir = fat12_list_files(arg);
+            if (dir >= 0) prefetch_listing(dir);
         } else if (!strcmp(command, "mount")) {
-            fat12_init();
-        } else if (!strcmp(command, "cat")) {
-            if (fat12_initialized) {
-                if (fat12_find_file(arg)) {
-                    char buffer[4096];
-                    int size = fat12_read_file(arg, buffer, sizeof(buffer));
-                    if (size > 0) {
-                        for (int i = 0; i < size; i++) bios_putc(buffer[i]);
+            char *opt, *rest = arg;
+            int usage = 0, ram = 0;
+            fat12_lazy = 1;
+            while (rest[0]) {
+                split_command_arg(rest, &opt, &rest);
+                if (!strcmp(opt, "-n")) {
+                    disk_backend = DISK_BACKEND_FDC;
+                } else if (!strcmp(opt, "-b")) {
+                    disk_backend = DISK_BACKEND_BIOS;
+                } else if (!strcmp(opt, "-e")) {
+                    fat12_lazy = 0;
+                } else if (!strcmp(opt, "-r")) {
+                    ram = 1;
+                } else {
+                    usage = 1;
+                }
+            }
+            if (usage) {
+                console_puts("Usage: mount [-n native FDC | -b BIOS] [-e eager] [-r RAM disk]");
+            } else if (fat12_sync()) {
+                console_puts("Sync failed! 'umount' or 'sync' before mounting again.");
+            } else if (!fat12_init() && ram) {
+                console_puts("Copying to RAM disk...");
+                console_newline();
+                unsigned int n = ramdisk_load(
+                    arena_alloc(&scratch, (uint32_t)disk_geom.sectors_per_track << 9));
+                if (n == disk_geom.total_sectors) {
+                    console_puts("RAM disk ready");
+                } else if (n) {
+                    console_puts("Extended RAM short, ");
+                    console_putdec(n / 2);
+                    console_puts(" KB in RAM, the rest from the drive");
+                } else {
+                    console_puts("No RAM disk, reading from the drive");
+                }
+            } else if (fat12_initialized) {
+                prefetch_count = prefetch_pos = 0;
+                job_wake(prefetch_job);
+            }
+        } else if (!strcmp(command, "sync")) {
+            console_puts(fat12_sync() ? "Sync failed!" : "Synced");
+        } else if (!strcmp(command, "umount")) {
+            if (!fat12_initialized) {
+                console_puts("Not mounted");
+            } else if (fat12_unmount()) {
+                console_puts("Sync failed, still mounted!");
+            } else {
+                ramdisk_sectors = 0;
+                console_puts("A: unmounted");
+            }
+        } else if (!strcmp(command, "touch") || !strcmp(command, "append") ||
+                   !strcmp(command, "trunc") || !strcmp(command, "rm")) {
+            file_write_command(command, arg);
+        } else if (!strcmp(command, "ramdisk")) {
+            ramdisk_stat();
+        } else if (!strcmp(command, "fdcstat")) {
+            fdc_stat();
+        } else if (!strcmp(command, "cat") || !strcmp(command, "head") ||
+                   !strcmp(command, "tail")) {
+            // cat FILE | head [-c N] FILE | tail [-c N] FILE
+            uint32_t count = 512;
+            char *name = arg;
+            unsigned char usage = 0;
+            if (command[0] != 'c' && arg[0] == '-') {
+                char *opt, *num;
+                split_command_arg(arg, &opt, &name);
+                split_command_arg(name, &num, &name);
+                usage = strcmp(opt, "-c") || !num[0];
+                count = str_to_u32(num);
+            }
+
+            if (usage) {
+                console_puts("Usage: head|tail [-c bytes] FILE");
+            } else if (fat12_initialized) {
+                struct fat12_dir_entry *file = fat12_find_file(name);
+                if (file) {
+                    // Compressed files are shown decoded, through a ring
+                    // the size of their window
+                    struct lz_header lzh;
+                    int packed = lz_is_packed(file, &lzh);
+                    farptr_t ring = packed == 1 ? arena_alloc(&scratch, lz_window_bytes(&lzh)) : 0;
+
+                    uint32_t offset = 0, length = packed == 1 ? lzh.size : file->size;
+                    if (command[0] == 'h' && count < length) {
+                        length = count;
+                    } else if (command[0] == 't' && count < length) {
+                        offset = length - count;
+                        length = count;
+                    }
+                    if (packed == 1 && !ring) {
+                        console_puts("Not enough memory!");
+                    } else if (packed == 1 ? lz_stream_out(file, ring, offset, length)
+                                           : fat12_stream_out(file, offset, length)) {
+                        console_newline();
+                        console_puts("Read error!");
                     }
                 } else {
-                    bios_puts("File not found!");
+                    console_puts("File not found!");
                 }
             } else {
-                bios_puts("Error: FAT12 not mounted! Use 'mount' first.");
+                console_puts("Error: FAT12 not mounted! Use 'mount' first.");
             }
+        } else if (!strcmp(command, "frag")) {
+            fat12_frag(arg);
+        } else if (!strcmp(command, "idxstat")) {
+            fat12_index_stat(arg);
+        } else if (!strcmp(command, "cachestat")) {
+            disk_cache_stat();
+        } else if (!strcmp(command, "flush")) {
+            disk_cache_flush();
+            console_puts("Track cache flushed");
         } else if (!strcmp(command, "beepon")) {
             if (arg[0] != 0) {
                 speaker_on(str_to_int(arg));
             } else {
-                bios_puts("Missing argument: frequency");
+                console_puts("Missing argument: frequency");
             }
         } else if (!strcmp(command, "beepoff")) {
             speaker_off();
         } else if (!strcmp(command, "run")) {
             if (fat12_initialized) {
-                if (fat12_find_file(arg)) {
-                    run_app(arg);
+                struct fat12_dir_entry *file = fat12_find_file(arg);
+                if (file) {
+                    run_app(file);
                 } else {
-                    bios_puts("File not found!");
+                    console_puts("File not found!");
                 }
             } else {
-                bios_puts("Error: FAT12 not mounted! Use 'mount' first.");
+                console_puts("Error: FAT12 not mounted! Use 'mount' first.");
             }
         } else {
-            bios_puts("Owhno, Unknwon command!");
+            console_puts("Owhno, Unknwon command!");
+        }
+        console_newline();
+        arena_release(&scratch);
+
+        if (timed) {
+            console_puts("time: ");
+            console_putdec(timer_us() - started);
+            console_puts(" us");
+            console_newline();
         }
-        bios_newline();
     }
 }
 
@@ -720,7 +2982,13 @@ void _start(void) {
         "mov  %ax, %ds      \n\t"
         "mov  %ax, %es      \n\t"
         "mov  %ax, %ss      \n\t"
-        "mov  $0x8000, %sp  \n\t"
+        "xor  %sp, %sp      \n\t"   // Stack at the top of the kernel segment
+        "mov  $__bss_start, %di \n\t"  // The loader only reads the image
+        "mov  $__bss_end, %cx   \n\t"
+        "sub  %di, %cx      \n\t"
+        "xor  %al, %al      \n\t"
+        "cld                \n\t"
+        "rep  stosb         \n\t"
         "sti                \n\t"
         "call kmain         \n\t"
         "hlt                \n\t"
@@ -0,0 +1,265 @@
+// Decoder for compressed files (see lz.h). The input arrives a cluster at a
+// time and the decoder can stop at any byte, so files are decoded as they
+// are read, straight into their final place.
+#include <stdint.h>
+#include "runtime.h"
+#include "fat12.h"
+#include "lz.h"
+
+#define LZ_TOKEN      0
+#define LZ_LITLEN     1
+#define LZ_LITERALS   2
+#define LZ_OFFSET_LO  3
+#define LZ_OFFSET_HI  4
+#define LZ_MATCHLEN   5
+#define LZ_MATCH      6
+#define LZ_DONE       7
+
+#define LZ_COPY_MAX   0x4000         // Keeps every far_memcpy inside a segment
+
+// `ring` is 0 for a flat buffer that takes the whole output, otherwise a
+// power of two of at least 2^window_bits
+void lz_init(struct lz_stream *s, farptr_t out, uint32_t ring, uint32_t size) {
+    s->out = FAR_NORM(out);
+    s->mask = ring ? ring - 1 : 0xFFFFFFFFUL;
+    s->pos = 0;
+    s->size = size;
+    s->count = 0;
+    s->flushed = 0;
+    s->offset = 0;
+    s->token = 0;
+    s->state = size ? LZ_TOKEN : LZ_DONE;
+}
+
+static inline farptr_t lz_at(const struct lz_stream *s, uint32_t pos) {
+    return FAR_ADD_LONG(s->out, pos & s->mask);
+}
+
+// `n` (at least 1) cut short where the ring wraps after `pos`
+static inline unsigned int lz_span(const struct lz_stream *s, uint32_t pos, unsigned int n) {
+    uint32_t left = s->mask - (pos & s->mask);
+    return left < n - 1 ? (unsigned int)left + 1 : n;
+}
+
+// Copy the match under way. Its bytes repeat with the period `offset`, so
+// once a whole period is out the source can step back twice as far: a run
+// of one byte takes a handful of copies, not one per byte.
+static void lz_copy_match(struct lz_stream *s, uint32_t out_end) {
+    unsigned int dist = s->offset;
+
+    while (s->count && s->pos < out_end) {
+        unsigned int n = dist;
+        if (n > LZ_COPY_MAX) n = LZ_COPY_MAX;
+        if (n > s->count) n = s->count;
+        if (n > out_end - s->pos) n = out_end - s->pos;
+
+        uint32_t from = s->pos - dist;
+        n = lz_span(s, s->pos, n);
+        n = lz_span(s, from, n);
+        far_memcpy(lz_at(s, s->pos), lz_at(s, from), n);
+        s->pos += n;
+        s->count -= n;
+
+        if (n == dist && dist <= LZ_COPY_MAX / 2 && 2UL * dist <= s->mask) dist *= 2;
+    }
+}
+
+// Decode from `len` bytes at `in` until they run out or `out_end` bytes
+// have been produced. Returns the input bytes used, -1 on corrupt data.
+long lz_decode(struct lz_stream *s, const unsigned char *in, unsigned int len, uint32_t out_end) {
+    unsigned int used = 0;
+
+    if (out_end > s->size) out_end = s->size;
+
+    while (s->pos < out_end) {
+        if (s->state == LZ_LITERALS) {
+            while (s->count && used < len && s->pos < out_end) {
+                unsigned int n = len - used;
+                if (n > s->count) n = s->count;
+                if (n > out_end - s->pos) n = out_end - s->pos;
+                n = lz_span(s, s->pos, n);
+                far_memcpy(lz_at(s, s->pos), near_to_far((void *)(in + used)), n);
+                s->pos += n;
+                s->count -= n;
+                used += n;
+            }
+            if (s->count) break;
+            s->state = s->pos == s->size ? LZ_DONE : LZ_OFFSET_LO;
+            continue;
+        }
+        if (s->state == LZ_MATCH) {
+            lz_copy_match(s, out_end);
+            if (s->count) break;
+            s->state = s->pos == s->size ? LZ_DONE : LZ_TOKEN;
+            continue;
+        }
+        if (used == len) break;
+
+        unsigned char b = in[used++];
+        switch (s->state) {
+        case LZ_TOKEN:
+            s->token = b;
+            s->count = b >> 4;
+            s->state = s->count == 15 ? LZ_LITLEN : LZ_LITERALS;
+            break;
+        case LZ_LITLEN:
+            s->count += b;
+            if (b != 255) s->state = LZ_LITERALS;
+            break;
+        case LZ_OFFSET_LO:
+            s->offset = b;
+            s->state = LZ_OFFSET_HI;
+            break;
+        case LZ_OFFSET_HI:
+            s->offset |= (uint16_t)b << 8;
+            if (s->offset == 0 || s->offset > s->pos || s->offset > s->mask) return -1;
+            s->count = (s->token & 15) + LZ_MIN_MATCH;
+            s->state = (s->token & 15) == 15 ? LZ_MATCHLEN : LZ_MATCH;
+            break;
+        case LZ_MATCHLEN:
+            s->count += b;
+            if (b != 255) s->state = LZ_MATCH;
+            break;
+        default:
+            return -1;
+        }
+
+        // Lengths are only complete when their state is left
+        if ((s->state == LZ_LITERALS || s->state == LZ_MATCH) && s->count > s->size - s->pos) {
+            return -1;
+        }
+    }
+    return used;
+}
+
+static int lz_check(const struct lz_header *hdr, uint32_t file_size) {
+    if (hdr->magic != LZ_MAGIC || hdr->header_bytes < sizeof(*hdr)) return -1;
+    if (hdr->window_bits < 8 || hdr->window_bits > LZ_MAX_WINDOW) return -1;
+    if (hdr->packed > file_size || hdr->header_bytes > file_size - hdr->packed) return -1;
+    return 0;
+}
+
+// Open `entry` and read its first chunk. Returns 1 for a compressed file,
+// with its header in *hdr and *len sequence bytes at stream_buf[0] + *start;
+// 0 if it is not one, -1 when the chunk cannot be read.
+static int lz_open(const struct fat12_dir_entry *entry, struct fat12_file *f,
+                   struct lz_header *hdr, unsigned int *start, unsigned int *len) {
+    long n;
+
+    if (entry->size < sizeof(*hdr) || fat12_open(entry, f)) return 0;
+    n = fat12_read_chunk(f, stream_buf[0], STREAM_CHUNK_BYTES, start);
+    if (n < 0) return -1;
+    if ((unsigned long)n < sizeof(*hdr)) return 0;
+
+    far_memcpy(near_to_far(hdr), near_to_far(stream_buf[0] + *start), sizeof(*hdr));
+    if (lz_check(hdr, entry->size) || hdr->header_bytes > n) return 0;
+    *start += hdr->header_bytes;
+    *len = n - hdr->header_bytes;
+    return 1;
+}
+
+// 1 if `entry` is a compressed file, with its header in *hdr
+int lz_is_packed(const struct fat12_dir_entry *entry, struct lz_header *hdr) {
+    struct fat12_file f;
+    unsigned int start, len;
+    int packed = lz_open(entry, &f, hdr, &start, &len);
+
+    fat12_close(&f);
+    return packed;
+}
+
+// Decode until `out_end` bytes are out: the sequences left in the first
+// chunk, then a chunk (never more than a cluster) at a time. With a ring,
+// `drain` empties it whenever it fills up.
+static int lz_pump(struct fat12_file *f, const struct lz_header *hdr, struct lz_stream *s,
+                   unsigned int start, unsigned int avail, uint32_t out_end,
+                   void (*drain)(struct lz_stream *s)) {
+    const unsigned char *in = stream_buf[0] + start;
+    uint32_t left = hdr->packed;
+    long n = 0;
+
+    for (;;) {
+        if (avail > left) avail = (unsigned int)left;
+        left -= avail;
+
+        while (avail && s->pos < out_end) {
+            uint32_t end = out_end;
+            if (drain && end - s->flushed > s->mask) end = s->flushed + s->mask + 1;
+
+            long used = lz_decode(s, in, avail, end);
+            if (used < 0) return -1;
+            in += used;
+            avail -= used;
+            if (drain) drain(s);
+        }
+        if (s->pos >= out_end || !left) break;
+
+        n = fat12_read_chunk(f, stream_buf[0], STREAM_CHUNK_BYTES, &start);
+        if (n <= 0) break;
+        in = stream_buf[0] + start;
+        avail = n;
+    }
+    return n < 0 || s->pos < out_end ? -1 : 0;
+}
+
+// Decode at most `max_size` bytes of `entry` to `dst`. Returns the bytes
+// decoded or -1.
+long lz_read_file(const struct fat12_dir_entry *entry, farptr_t dst, uint32_t max_size) {
+    struct fat12_file f;
+    struct lz_header hdr;
+    struct lz_stream s;
+    unsigned int start, len;
+    int err = -1;
+
+    if (lz_open(entry, &f, &hdr, &start, &len) == 1) {
+        if (max_size > hdr.size) max_size = hdr.size;
+        lz_init(&s, dst, 0, hdr.size);
+        err = lz_pump(&f, &hdr, &s, start, len, max_size, 0);
+    }
+    fat12_close(&f);
+    return err ? -1 : (long)max_size;
+}
+
+// Bytes of the decoded file lz_print passes to the console
+static uint32_t lz_print_from, lz_print_end;
+
+static void lz_print(struct lz_stream *s) {
+    while (s->flushed < s->pos) {
+        uint32_t at = s->flushed;
+        unsigned int n = s->pos - at > STREAM_CHUNK_BYTES ? STREAM_CHUNK_BYTES
+                                                          : (unsigned int)(s->pos - at);
+        n = lz_span(s, at, n);
+
+        uint32_t a = at > lz_print_from ? at : lz_print_from;
+        uint32_t b = at + n < lz_print_end ? at + n : lz_print_end;
+        if (a < b) {
+            far_memcpy(near_to_far(stream_buf[1]), lz_at(s, a), b - a);
+            console_write((const char *)stream_buf[1], b - a);
+        }
+        s->flushed += n;
+    }
+}
+
+// Print `length` decoded bytes of `entry` from `offset`. The file is
+// decoded from the start through `ring`, lz_window_bytes() long; bytes
+// before `offset` are decoded but not printed.
+int lz_stream_out(const struct fat12_dir_entry *entry, farptr_t ring, uint32_t offset,
+                  uint32_t length) {
+    struct fat12_file f;
+    struct lz_header hdr;
+    struct lz_stream s;
+    unsigned int start, len;
+    int err = -1;
+
+    if (lz_open(entry, &f, &hdr, &start, &len) == 1) {
+        if (offset > hdr.size) offset = hdr.size;
+        if (length > hdr.size - offset) length = hdr.size - offset;
+
+        lz_print_from = offset;
+        lz_print_end = offset + length;
+        lz_init(&s, ring, lz_window_bytes(&hdr), hdr.size);
+        err = lz_pump(&f, &hdr, &s, start, len, lz_print_end, lz_print);
+    }
+    fat12_close(&f);
+    return err;
+}
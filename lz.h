@@ -0,0 +1,54 @@
+// Compressed files: a 16-byte header, then LZ4-style sequences. Each
+// sequence is a token (literal count in the high nibble, match length - 4
+// in the low one, 15 meaning more length bytes follow, each adding up to
+// 255), the literals, then a 16-bit little-endian match offset and any
+// extra match length bytes. The stream ends once `size` bytes are out, so
+// the last sequence may stop after its literals. Decoding is copies only:
+// no tables, no bit I/O, which is what an 8086 does quickly.
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include "runtime.h"
+#include "fat12.h"
+
+#define LZ_MAGIC       0x5A4C        // "LZ"
+#define LZ_MIN_MATCH   4
+#define LZ_MAX_WINDOW  16            // Offsets are 16 bits
+
+struct __attribute__((packed)) lz_header {
+    uint16_t magic;                  // LZ_MAGIC
+    uint8_t  header_bytes;           // Sequences start here
+    uint8_t  window_bits;            // Largest offset is 2^window_bits - 1
+    uint32_t size;                   // Decoded bytes
+    uint32_t packed;                 // Sequence bytes after the header
+    uint32_t reserved;
+};
+
+// Decoder state; everything needed to resume at any input byte
+struct lz_stream {
+    farptr_t out;                    // Start of the output buffer
+    uint32_t mask;                   // Ring size - 1, or 0xFFFFFFFF for a flat buffer
+    uint32_t pos;                    // Bytes decoded so far
+    uint32_t size;                   // Bytes to decode in all
+    uint32_t count;                  // Literals or match bytes still to go
+    uint32_t flushed;                // Bytes taken out of the ring so far
+    uint16_t offset;
+    uint8_t  token;
+    uint8_t  state;
+};
+
+// Ring size for decoding `hdr`'s file; no 32-bit variable shift on ia16
+static inline uint32_t lz_window_bytes(const struct lz_header *hdr) {
+    return hdr->window_bits >= 16 ? 0x10000UL : (uint32_t)(1u << hdr->window_bits);
+}
+
+void lz_init(struct lz_stream *s, farptr_t out, uint32_t ring, uint32_t size);
+long lz_decode(struct lz_stream *s, const unsigned char *in, unsigned int len, uint32_t out_end);
+
+int lz_is_packed(const struct fat12_dir_entry *entry, struct lz_header *hdr);
+long lz_read_file(const struct fat12_dir_entry *entry, farptr_t dst, uint32_t max_size);
+int lz_stream_out(const struct fat12_dir_entry *entry, farptr_t ring, uint32_t offset,
+                  uint32_t length);
+
+#endif
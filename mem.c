@@ -0,0 +1,312 @@
+// Far memory manager: heap, pools and arenas over conventional memory
+#include <stdint.h>
+#include "runtime.h"
+#include "mem.h"
+
+extern void far_memsetw(farptr_t dst, unsigned short value, unsigned short count);
+
+void console_puts(const char *s);
+void console_newline(void);
+void console_putdec(uint32_t val);
+
+// The heap is a table of blocks sorted by segment that tiles it without
+// gaps; free neighbours are merged as soon as a block is released
+struct mem_block {
+    unsigned short seg;
+    unsigned short paras;
+    unsigned char  tag;
+};
+
+static struct mem_block mem_blocks[MEM_MAX_BLOCKS];
+static unsigned int mem_block_count;
+static unsigned short mem_base, mem_top;
+static uint32_t mem_allocs, mem_failures;
+
+static const char *const mem_tag_names[] = { "free", "pool", "arena", "prof" };
+
+void mem_init(unsigned short top) {
+    mem_base = MEM_HEAP_BASE;
+    mem_top = top > mem_base ? top : mem_base;
+    mem_block_count = 0;
+    if (mem_top > mem_base) {
+        mem_blocks[0].seg = mem_base;
+        mem_blocks[0].paras = mem_top - mem_base;
+        mem_blocks[0].tag = MEM_TAG_FREE;
+        mem_block_count = 1;
+    }
+}
+
+// Split block `i` so that a new block begins at `seg`; returns its index
+static int mem_split(unsigned int i, unsigned short seg) {
+    struct mem_block *b = &mem_blocks[i];
+
+    if (seg == b->seg) return i;
+    if (mem_block_count == MEM_MAX_BLOCKS) return -1;
+
+    for (unsigned int j = mem_block_count; j > i + 1; j--) mem_blocks[j] = mem_blocks[j - 1];
+    mem_block_count++;
+
+    mem_blocks[i + 1].seg = seg;
+    mem_blocks[i + 1].paras = b->seg + b->paras - seg;
+    mem_blocks[i + 1].tag = b->tag;
+    b->paras = seg - b->seg;
+    return i + 1;
+}
+
+// Take `paras` at `seg` out of free block `i`. A leftover tail that does
+// not fit in the table stays with the allocation.
+static unsigned short mem_carve(unsigned int i, unsigned short seg, unsigned short paras,
+                                unsigned char tag) {
+    int at = mem_split(i, seg);
+    if (at < 0) return 0;
+
+    if (mem_blocks[at].paras > paras) mem_split(at, seg + paras);
+    mem_blocks[at].tag = tag;
+    mem_allocs++;
+    return seg;
+}
+
+// First fit
+unsigned short mem_alloc(unsigned short paras, unsigned char tag) {
+    unsigned short seg = 0;
+
+    for (unsigned int i = 0; paras && i < mem_block_count; i++) {
+        struct mem_block *b = &mem_blocks[i];
+        if (b->tag == MEM_TAG_FREE && b->paras >= paras) {
+            seg = mem_carve(i, b->seg, paras, tag);
+            break;
+        }
+    }
+    if (!seg) mem_failures++;
+    return seg;
+}
+
+// First fit that does not cross a 64 KB physical boundary, for buffers
+// the floppy DMA channel writes into
+unsigned short mem_alloc_dma(unsigned short paras, unsigned char tag) {
+    unsigned short seg = 0;
+
+    for (unsigned int i = 0; paras && paras <= MEM_WINDOW_PARAS && i < mem_block_count; i++) {
+        struct mem_block *b = &mem_blocks[i];
+        if (b->tag != MEM_TAG_FREE) continue;
+
+        unsigned short at = b->seg;
+        if ((at >> 12) != ((at + paras - 1) >> 12)) at = (at + 0x0FFF) & 0xF000;
+        if ((uint32_t)at + paras <= (uint32_t)b->seg + b->paras) {
+            seg = mem_carve(i, at, paras, tag);
+            break;
+        }
+    }
+    if (!seg) mem_failures++;
+    return seg;
+}
+
+void mem_free(unsigned short seg) {
+    unsigned int i;
+
+    for (i = 0; i < mem_block_count; i++) {
+        if (mem_blocks[i].seg == seg && mem_blocks[i].tag != MEM_TAG_FREE) break;
+    }
+    if (i == mem_block_count) return;
+    mem_blocks[i].tag = MEM_TAG_FREE;
+
+    // Merge with the next block, then the previous one
+    for (unsigned int k = 0; k < 2; k++) {
+        unsigned int lo = k ? i - 1 : i;
+        if ((k && i == 0) || lo + 1 >= mem_block_count) continue;
+        if (mem_blocks[lo].tag != MEM_TAG_FREE || mem_blocks[lo + 1].tag != MEM_TAG_FREE) continue;
+
+        mem_blocks[lo].paras += mem_blocks[lo + 1].paras;
+        for (unsigned int j = lo + 1; j + 1 < mem_block_count; j++) mem_blocks[j] = mem_blocks[j + 1];
+        mem_block_count--;
+    }
+}
+
+// Heap map and totals; fragmentation is the share of free memory outside
+// the largest free block
+void mem_stat(void) {
+    uint32_t free_paras = 0, used_paras = 0;
+    unsigned short largest = 0;
+    unsigned int free_blocks = 0;
+
+    console_puts("Heap: ");
+    console_putdec((uint32_t)(mem_top - mem_base) / 64);
+    console_puts(" KB at segment ");
+    console_putdec(mem_base);
+    console_newline();
+
+    for (unsigned int i = 0; i < mem_block_count; i++) {
+        struct mem_block *b = &mem_blocks[i];
+        console_puts("  ");
+        console_putdec(b->seg);
+        console_puts(": ");
+        console_putdec(umul16x16(b->paras, 16));
+        console_puts(" bytes ");
+        console_puts(mem_tag_names[b->tag]);
+        console_newline();
+
+        if (b->tag == MEM_TAG_FREE) {
+            free_paras += b->paras;
+            free_blocks++;
+            if (b->paras > largest) largest = b->paras;
+        } else {
+            used_paras += b->paras;
+        }
+    }
+
+    console_puts("Used: ");
+    console_putdec(used_paras / 64);
+    console_puts(" KB  Free: ");
+    console_putdec(free_paras / 64);
+    console_puts(" KB in ");
+    console_putdec(free_blocks);
+    console_puts(" blocks  Largest: ");
+    console_putdec(largest / 64);
+    console_puts(" KB");
+    console_newline();
+    if (free_paras) {
+        console_puts("Fragmentation: ");
+        console_putdec(100 - udiv32(umul32_16(largest, 100), free_paras, 0));
+        console_puts("%");
+        console_newline();
+    }
+    console_puts("Allocations: ");
+    console_putdec(mem_allocs);
+    console_puts("  Failed: ");
+    console_putdec(mem_failures);
+    console_newline();
+}
+
+// Up to `count` objects, fewer if memory is short. Returns the number made.
+unsigned int pool_init(struct mem_pool *p, const char *name, unsigned int obj_bytes,
+                       unsigned int count, unsigned char dma) {
+    p->name = name;
+    p->obj_paras = (obj_bytes + 15) >> 4;
+    p->count = 0;
+    p->free_mask = 0;
+    p->block_mask = 0;
+    if (count > POOL_MAX_OBJECTS) count = POOL_MAX_OBJECTS;
+
+    while (p->count < count) {
+        unsigned int n = count - p->count;
+        if (dma && n > MEM_WINDOW_PARAS / p->obj_paras) n = MEM_WINDOW_PARAS / p->obj_paras;
+
+        // Shrink the block until it fits
+        unsigned short seg = 0;
+        while (n && !(seg = dma ? mem_alloc_dma(n * p->obj_paras, MEM_TAG_POOL)
+                                : mem_alloc(n * p->obj_paras, MEM_TAG_POOL))) {
+            n--;
+        }
+        if (!seg) break;
+
+        p->block_mask |= 1u << p->count;
+        for (unsigned int i = 0; i < n; i++) {
+            p->seg[p->count] = seg + i * p->obj_paras;
+            p->free_mask |= 1u << p->count;
+            p->count++;
+        }
+    }
+    return p->count;
+}
+
+void pool_destroy(struct mem_pool *p) {
+    for (unsigned int i = 0; i < p->count; i++) {
+        if (p->block_mask & (1u << i)) mem_free(p->seg[i]);
+    }
+    p->count = 0;
+    p->free_mask = 0;
+    p->block_mask = 0;
+}
+
+void pool_stat(const struct mem_pool *p) {
+    unsigned int in_use = 0;
+    for (unsigned int i = 0; i < p->count; i++) {
+        if (!(p->free_mask & (1u << i))) in_use++;
+    }
+
+    console_puts("Pool ");
+    console_puts(p->name ? p->name : "-");
+    console_puts(": ");
+    console_putdec(in_use);
+    console_puts("/");
+    console_putdec(p->count);
+    console_puts(" x ");
+    console_putdec(umul16x16(p->obj_paras, 16));
+    console_puts(" bytes");
+    console_newline();
+}
+
+// 0 when every object is taken
+farptr_t pool_get(struct mem_pool *p) {
+    for (unsigned int i = 0; i < p->count; i++) {
+        if (p->free_mask & (1u << i)) {
+            p->free_mask &= ~(1u << i);
+            return MK_FAR(p->seg[i], 0);
+        }
+    }
+    return 0;
+}
+
+void pool_put(struct mem_pool *p, farptr_t obj) {
+    for (unsigned int i = 0; i < p->count; i++) {
+        if (p->seg[i] == FAR_SEG(obj)) p->free_mask |= 1u << i;
+    }
+}
+
+// Paragraph-aligned; 0 when the heap or the chunk table is exhausted
+farptr_t arena_alloc(struct mem_arena *a, uint32_t bytes) {
+    uint32_t paras = (bytes + 15) >> 4;
+    unsigned int last = a->chunks - 1;
+
+    if (paras == 0 || paras > 0xFFFF) return 0;
+    if (!a->chunks || (uint32_t)(a->size[last] - a->used) < paras) {
+        if (a->chunks == ARENA_MAX_CHUNKS) return 0;
+
+        unsigned short size = paras > ARENA_CHUNK_PARAS ? (unsigned short)paras : ARENA_CHUNK_PARAS;
+        unsigned short seg = mem_alloc(size, MEM_TAG_ARENA);
+        if (!seg) return 0;
+
+        last = a->chunks++;
+        a->seg[last] = seg;
+        a->size[last] = size;
+        a->used = 0;
+    }
+
+    farptr_t p = MK_FAR(a->seg[last] + a->used, 0);
+    a->used += (unsigned short)paras;
+    a->bytes += paras << 4;
+    if (a->bytes > a->high_water) a->high_water = a->bytes;
+    return p;
+}
+
+void arena_release(struct mem_arena *a) {
+    while (a->chunks) mem_free(a->seg[--a->chunks]);
+    a->used = 0;
+    a->bytes = 0;
+}
+
+void far_copy(farptr_t dst, farptr_t src, uint32_t len) {
+    dst = FAR_NORM(dst);
+    src = FAR_NORM(src);
+    while (len) {
+        unsigned short n = len > 0x8000 ? 0x8000 : (unsigned short)len;
+        far_memcpy(dst, src, n);
+        dst = FAR_ADD(dst, n);
+        src = FAR_ADD(src, n);
+        len -= n;
+    }
+}
+
+void far_zero(farptr_t dst, uint32_t len) {
+    dst = FAR_NORM(dst);
+    while (len > 1) {
+        unsigned short n = len > 0x8000 ? 0x8000 : (unsigned short)len & ~1u;
+        far_memsetw(dst, 0, n >> 1);
+        dst = FAR_ADD(dst, n);
+        len -= n;
+    }
+    if (len) {
+        unsigned char zero = 0;
+        far_memcpy(dst, near_to_far(&zero), 1);
+    }
+}
@@ -0,0 +1,67 @@
+// Far memory: a paragraph-granular heap over the conventional memory above
+// the kernel segment, fixed-size object pools carved from it, and scoped
+// bump arenas for per-command scratch.
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdint.h>
+#include "runtime.h"
+
+#define MEM_HEAP_BASE    0x2000      // First paragraph above the kernel's 64 KB
+#define MEM_MAX_BLOCKS   32          // Free and used blocks together
+#define MEM_WINDOW_PARAS 0x1000      // 64 KB physical window (DMA boundary)
+
+// Owners, shown by 'mem'
+#define MEM_TAG_FREE  0
+#define MEM_TAG_POOL  1
+#define MEM_TAG_ARENA 2
+#define MEM_TAG_PROF  3
+
+void mem_init(unsigned short top);
+unsigned short mem_alloc(unsigned short paras, unsigned char tag);
+unsigned short mem_alloc_dma(unsigned short paras, unsigned char tag);
+void mem_free(unsigned short seg);
+void mem_stat(void);
+
+// Objects never cross a 64 KB boundary when the pool is DMA-safe; each
+// window's worth is one heap block, so consecutive objects in a window are
+// adjacent in memory
+#define POOL_MAX_OBJECTS 16
+
+struct mem_pool {
+    const char     *name;
+    unsigned short obj_paras;
+    unsigned char  count;            // Objects actually allocated
+    uint16_t       free_mask;        // Bit i set: object i is free
+    uint16_t       block_mask;       // Bit i set: object i starts a heap block
+    unsigned short seg[POOL_MAX_OBJECTS];
+};
+
+unsigned int pool_init(struct mem_pool *p, const char *name, unsigned int obj_bytes,
+                       unsigned int count, unsigned char dma);
+void pool_destroy(struct mem_pool *p);
+farptr_t pool_get(struct mem_pool *p);
+void pool_put(struct mem_pool *p, farptr_t obj);
+void pool_stat(const struct mem_pool *p);
+
+// Bump allocation in heap chunks; arena_release gives all of it back at once
+#define ARENA_CHUNK_PARAS 0x100      // 4 KB, larger requests get their own chunk
+#define ARENA_MAX_CHUNKS  8
+
+struct mem_arena {
+    unsigned char  chunks;
+    unsigned short seg[ARENA_MAX_CHUNKS];
+    unsigned short size[ARENA_MAX_CHUNKS];   // Paragraphs
+    unsigned short used;                     // Paragraphs used in the last chunk
+    uint32_t       bytes;                    // Handed out, for the high-water mark
+    uint32_t       high_water;
+};
+
+farptr_t arena_alloc(struct mem_arena *a, uint32_t bytes);
+void arena_release(struct mem_arena *a);
+
+// Copies and fills of any length; pointers are normalized as they advance
+void far_copy(farptr_t dst, farptr_t src, uint32_t len);
+void far_zero(farptr_t dst, uint32_t len);
+
+#endif
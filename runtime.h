@@ -0,0 +1,164 @@
+// Freestanding runtime shared by kernel.c and fat12.c: far pointers and
+// 32-bit arithmetic. Built natively (no __ia16__) for the host tools, far
+// pointers become plain pointers and the arithmetic uses the C operators,
+// divides split into 16-bit steps the way the kernel does them.
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdint.h>
+
+#ifdef __ia16__
+
+// Far address in real mode: segment in the high word, offset in the low word
+typedef uint32_t farptr_t;
+
+#define MK_FAR(seg, off) (((farptr_t)(seg) << 16) | (uint16_t)(off))
+#define FAR_SEG(p)       ((uint16_t)((p) >> 16))
+#define FAR_OFF(p)       ((uint16_t)(p))
+
+// Advance a far pointer by whole 512-byte sectors (32 paragraphs each)
+#define FAR_ADD_SECTORS(p, n) MK_FAR(FAR_SEG(p) + (uint16_t)(n) * 32, FAR_OFF(p))
+
+// Fold the offset into the segment (offset < 16); FAR_ADD steps a
+// normalized pointer by `n` bytes, n + 16 must stay below 64 KB
+#define FAR_NORM(p)   MK_FAR(FAR_SEG(p) + (FAR_OFF(p) >> 4), FAR_OFF(p) & 15)
+#define FAR_ADD(p, n) FAR_NORM((p) + (uint16_t)(n))
+
+// Address `n` bytes (any 32-bit count below 1 MB) past a normalized pointer
+#define FAR_ADD_LONG(p, n) MK_FAR(FAR_SEG(p) + (uint16_t)((uint32_t)(n) >> 4), \
+                                  FAR_OFF(p) + ((uint16_t)(n) & 15))
+
+static inline unsigned short get_ds(void) {
+    unsigned short ds;
+    __asm__ __volatile__("mov %%ds, %0" : "=r"(ds));
+    return ds;
+}
+
+static inline unsigned short get_cs(void) {
+    unsigned short cs;
+    __asm__ __volatile__("mov %%cs, %0" : "=r"(cs));
+    return cs;
+}
+
+static inline farptr_t near_to_far(void *p) {
+    return MK_FAR(get_ds(), (unsigned short)p);
+}
+
+extern void far_memcpy(farptr_t dst, farptr_t src, unsigned short len);
+
+#else
+
+// Host build: far pointers are plain pointers
+typedef unsigned char *farptr_t;
+
+#define FAR_ADD_SECTORS(p, n) ((p) + (uint32_t)(n) * 512)
+#define FAR_NORM(p)           (p)
+#define FAR_ADD(p, n)         ((p) + (n))
+#define FAR_ADD_LONG(p, n)    ((p) + (uint32_t)(n))
+
+static inline farptr_t near_to_far(void *p) {
+    return (farptr_t)p;
+}
+
+extern void far_memcpy(farptr_t dst, farptr_t src, unsigned short len);
+
+#endif
+
+#ifdef __ia16__
+
+// 32-bit arithmetic runtime. There is no libgcc in the kernel, so 32-bit
+// multiply, divide and modulo go through these instead of the C operators.
+// None of them loops on the quotient: udiv32_16 is always two DIVs, and
+// udiv32 takes that path or a fixed 32 steps depending on whether the
+// divisor fits in 16 bits.
+
+// 16x16 -> 32 multiply with a single MUL
+static inline uint32_t umul16x16(uint16_t a, uint16_t b) {
+    uint16_t lo, hi;
+    __asm__ ("mulw %3" : "=a"(lo), "=d"(hi) : "a"(a), "rm"(b) : "cc");
+    return ((uint32_t)hi << 16) | lo;
+}
+
+// 32x16 -> 32 multiply (low 32 bits of the product)
+static inline uint32_t umul32_16(uint32_t a, uint16_t b) {
+    return umul16x16((uint16_t)a, b) + (umul16x16((uint16_t)(a >> 16), b) << 16);
+}
+
+// 32/16 divide as two chained DIVs (high word, then remainder:low word),
+// which can never overflow. `rem` may be 0.
+static inline uint32_t udiv32_16(uint32_t n, uint16_t d, uint16_t *rem) {
+    uint16_t qhi, qlo, r;
+    __asm__ ("divw %4" : "=a"(qhi), "=d"(r) : "a"((uint16_t)(n >> 16)), "d"((uint16_t)0), "rm"(d) : "cc");
+    __asm__ ("divw %4" : "=a"(qlo), "=d"(r) : "a"((uint16_t)n), "d"(r), "rm"(d) : "cc");
+    if (rem) *rem = r;
+    return ((uint32_t)qhi << 16) | qlo;
+}
+
+#else
+
+static inline uint32_t umul16x16(uint16_t a, uint16_t b) {
+    return (uint32_t)a * b;
+}
+
+static inline uint32_t umul32_16(uint32_t a, uint16_t b) {
+    return a * b;
+}
+
+// The same two steps as the DIV pair, so tools/runtime_test.c checks the
+// split the kernel relies on
+static inline uint32_t udiv32_16(uint32_t n, uint16_t d, uint16_t *rem) {
+    uint16_t hi = n >> 16;
+    uint32_t lo = ((uint32_t)(hi % d) << 16) | (uint16_t)n;
+    if (rem) *rem = lo % d;
+    return ((uint32_t)(hi / d) << 16) | (uint16_t)(lo / d);
+}
+
+#endif
+
+static inline uint16_t umod32_16(uint32_t n, uint16_t d) {
+    uint16_t r;
+    udiv32_16(n, d, &r);
+    return r;
+}
+
+// 32/32 divide: hardware path for 16-bit divisors, otherwise a fixed
+// 32-step shift-and-subtract. `rem` may be 0.
+static inline uint32_t udiv32(uint32_t n, uint32_t d, uint32_t *rem) {
+    if (!(d >> 16)) {
+        uint16_t r16;
+        uint32_t q = udiv32_16(n, (uint16_t)d, &r16);
+        if (rem) *rem = r16;
+        return q;
+    }
+
+    uint32_t q = 0, r = 0;
+    for (int i = 0; i < 32; i++) {
+        r = (r << 1) | (n >> 31);
+        n <<= 1;
+        q <<= 1;
+        if (r >= d) {
+            r -= d;
+            q |= 1;
+        }
+    }
+    if (rem) *rem = r;
+    return q;
+}
+
+// Write `val` in decimal to `buf` (at least 11 bytes), return the length
+static inline int u32_to_dec(uint32_t val, char *buf) {
+    char tmp[10];
+    int i = 0, n = 0;
+
+    do {
+        uint16_t digit;
+        val = udiv32_16(val, 10, &digit);
+        tmp[i++] = '0' + digit;
+    } while (val);
+
+    while (i--) buf[n++] = tmp[i];
+    buf[n] = 0;
+    return n;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Boot a BubblesOS image headless in QEMU and time a fixed shell script.
+
+The image must be built with SERIAL=1 so the shell runs on COM1. Each
+command is sent as "time <command>", followed by "stats" to pick up the
+kernel counters. One CSV row per command goes to stdout: the elapsed
+microseconds and the change in each counter. With --prof the script runs
+under the kernel's sampling profiler and the 'prof dump' output is saved
+for tools/prof.py.
+
+Usage: bench.py [--qemu BIN] [--timeout SECONDS] [--prof FILE] IMAGE
+"""
+
+import argparse
+import os
+import re
+import select
+import subprocess
+import sys
+import time
+
+SCRIPT = [
+    "mount",
+    "ls",
+    "cat F1K.TXT",
+    "cat F4K.TXT",
+    "cat F32K.TXT",
+    "cat F32K.TXT",      # Again, from the track cache
+    "cat FRAG32K.TXT",
+    "run APP8K.BIN",
+    "cat LZ/F32K.TXT",   # Same files, compressed
+    "run LZ/APP8K.BIN",
+    "mount -r",          # Whole volume copied to extended memory
+    "cat F32K.TXT",
+    "cat FRAG32K.TXT",
+    "run APP8K.BIN",
+]
+
+COUNTERS = [
+    "sectors_read",
+    "disk_sectors",
+    "bios_calls",
+    "retries",
+    "cache_hits",
+    "cache_misses",
+    "ramdisk_sectors",
+    "bytes_printed",
+]
+
+PROMPT = re.compile(rb"\n>$")
+TIME = re.compile(rb"time: (\d+) us")
+STAT = re.compile(rb"^(\w+)=(\d+)\r?$", re.M)
+
+
+class Shell:
+    def __init__(self, qemu, image, timeout):
+        self.timeout = timeout
+        self.proc = subprocess.Popen(
+            [qemu,
+             "-drive", "file=%s,format=raw,if=floppy" % image,
+             "-boot", "a", "-display", "none", "-monitor", "none",
+             "-serial", "stdio", "-no-reboot"],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+    def wait_prompt(self):
+        out = b""
+        deadline = time.monotonic() + self.timeout
+        fd = self.proc.stdout.fileno()
+        while not PROMPT.search(out):
+            left = deadline - time.monotonic()
+            if left <= 0 or self.proc.poll() is not None:
+                sys.exit("bench: no prompt, got %r" % out[-200:])
+            if select.select([fd], [], [], left)[0]:
+                out += os.read(fd, 4096)
+        return out
+
+    def run(self, command):
+        # The shell echoes every key, so send it all at once and let the
+        # 256-byte RX ring absorb it
+        self.proc.stdin.write(command.encode() + b"\r")
+        self.proc.stdin.flush()
+        return self.wait_prompt()
+
+    def stats(self):
+        return {k.decode(): int(v) for k, v in STAT.findall(self.run("stats"))}
+
+    def close(self):
+        self.proc.kill()
+        self.proc.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image")
+    parser.add_argument("--qemu", default="qemu-system-i386")
+    parser.add_argument("--timeout", type=float, default=60)
+    parser.add_argument("--prof", metavar="FILE")
+    args = parser.parse_args()
+
+    shell = Shell(args.qemu, args.image, args.timeout)
+    try:
+        shell.wait_prompt()
+        print(",".join(["command", "us"] + COUNTERS))
+        before = shell.stats()
+        if args.prof:
+            shell.run("prof start")
+        for command in SCRIPT:
+            out = shell.run("time " + command)
+            m = TIME.search(out)
+            if not m:
+                sys.exit("bench: no timing for %r" % command)
+            after = shell.stats()
+            deltas = [str(after.get(k, 0) - before.get(k, 0)) for k in COUNTERS]
+            print(",".join([command, m.group(1).decode()] + deltas))
+            sys.stdout.flush()
+            # Don't charge the stats output to the next command
+            before = shell.stats()
+        if args.prof:
+            shell.run("prof stop")
+            with open(args.prof, "wb") as f:
+                f.write(shell.run("prof dump"))
+    finally:
+        shell.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,503 @@
+// fat12_bench: fat12.c built natively, over a floppy image in memory
+//
+// Usage: fat12_bench [-v] [-e] IMAGE [ITERATIONS]
+//
+//   -v   show the driver's console output (mount messages)
+//   -e   eager mount: read the whole FAT and root directory up front
+//
+// Implements the platform hooks from fat12.h. disk_read_sectors and
+// disk_write_sectors split requests per track as the kernel's track cache
+// does, but with no cache underneath: every request is charged to a simple
+// 3.5" drive model (seek per cylinder, head settle, rotational latency at
+// 300 RPM), so the simulated time reflects the access pattern of the
+// driver alone. Writes change the image in memory only.
+//
+// Each benchmark prints one CSV row: host time per operation, plus the
+// disk requests, sectors, seeks and simulated drive time it caused.
+//
+// The hooks are also linked into tools/fat12_test.c, with the benchmarks
+// left out (-DFAT12_HOST_NO_MAIN).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../fat12.h"
+#include "../lz.h"
+
+#define DRIVE_REV_US     200000      // 300 RPM
+#define DRIVE_STEP_US    3000        // Per cylinder
+#define DRIVE_SETTLE_US  15000       // After any seek
+
+static uint8_t *image;
+static uint32_t image_size;
+static int verbose;
+
+// Drive model state and counters
+static unsigned drive_cyl;
+static uint64_t sim_us;
+
+struct disk_counters {
+    uint64_t requests;               // Per-track transfers
+    uint64_t sectors;
+    uint64_t seeks;
+    uint64_t sim_us;
+};
+
+static struct disk_counters disk;
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "fat12_bench: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+static uint64_t host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Platform hooks
+
+// Overlap is allowed with dst below src, as in the kernel's forward copy
+void far_memcpy(farptr_t dst, farptr_t src, unsigned short len) {
+    memmove(dst, src, len);
+}
+
+uint32_t timer_us(void) {
+    return (uint32_t)(host_ns() / 1000);
+}
+
+void console_write(const char *buf, unsigned int len) {
+    if (verbose) fwrite(buf, 1, len, stdout);
+}
+
+void console_putc(char c) {
+    console_write(&c, 1);
+}
+
+void console_puts(const char *s) {
+    console_write(s, strlen(s));
+}
+
+void console_newline(void) {
+    console_putc('\n');
+}
+
+void console_putdec(uint32_t val) {
+    if (verbose) printf("%lu", (unsigned long)val);
+}
+
+int disk_read_boot_sector(unsigned char drive, void *buf) {
+    (void)drive;
+    if (image_size < 512) return -1;
+    memcpy(buf, image, 512);
+    return 0;
+}
+
+farptr_t disk_sector_alloc(void) {
+    return malloc(512);
+}
+
+void disk_sector_free(farptr_t buf) {
+    free(buf);
+}
+
+void disk_configure(const struct disk_geometry *geom) {
+    (void)geom;
+    drive_cyl = 0;
+}
+
+// Time for one transfer of `count` sectors starting at `pos`
+static void drive_transfer(const struct chs_cursor *pos, unsigned count) {
+    unsigned spt = disk_geom.sectors_per_track;
+    uint64_t sector_us = DRIVE_REV_US / spt;
+
+    if (pos->cyl != drive_cyl) {
+        unsigned steps = pos->cyl > drive_cyl ? pos->cyl - drive_cyl : drive_cyl - pos->cyl;
+        sim_us += (uint64_t)steps * DRIVE_STEP_US + DRIVE_SETTLE_US;
+        drive_cyl = pos->cyl;
+        disk.seeks++;
+    }
+
+    // Wait for the first sector to come under the head, then read the run
+    uint64_t angle = sim_us % DRIVE_REV_US;
+    uint64_t start = (pos->sector - 1) * sector_us;
+    sim_us += (start + DRIVE_REV_US - angle) % DRIVE_REV_US;
+    sim_us += count * sector_us;
+
+    disk.requests++;
+    disk.sectors += count;
+}
+
+// Charge `count` sectors from `lba` to the drive, one transfer per track
+static void drive_access(unsigned int lba, unsigned int count) {
+    struct chs_cursor pos;
+
+    chs_seek(&disk_geom, &pos, lba);
+    while (count > 0) {
+        unsigned run = disk_geom.sectors_per_track - (pos.sector - 1);
+        if (run > count) run = count;
+        drive_transfer(&pos, run);
+        count -= run;
+        chs_advance(&disk_geom, &pos, run);
+    }
+    disk.sim_us = sim_us;
+}
+
+int disk_read_sectors(unsigned int lba, unsigned int count, farptr_t buffer) {
+    if ((uint64_t)(lba + count) * 512 > image_size) return -1;
+    memcpy(buffer, image + (uint64_t)lba * 512, (size_t)count * 512);
+    drive_access(lba, count);
+    return 0;
+}
+
+int disk_write_sectors(unsigned int lba, unsigned int count, farptr_t buffer) {
+    if ((uint64_t)(lba + count) * 512 > image_size) return -1;
+    memcpy(image + (uint64_t)lba * 512, buffer, (size_t)count * 512);
+    drive_access(lba, count);
+    return 0;
+}
+
+int disk_sync(void) {
+    return 0;
+}
+
+void clock_dos_time(uint16_t *date, uint16_t *time_) {
+    time_t now = time(0);
+    struct tm *tm = localtime(&now);
+    *date = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+    *time_ = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+}
+
+// Replace the image in memory with the contents of `path`, and return it
+uint8_t *host_load_image(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) die("cannot open", path);
+    fseek(f, 0, SEEK_END);
+    image_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    free(image);
+    image = malloc(image_size ? image_size : 1);
+    if (!image || fread(image, 1, image_size, f) != image_size) die("cannot read", path);
+    fclose(f);
+    return image;
+}
+
+#ifndef FAT12_HOST_NO_MAIN
+
+// Benchmarks
+
+#define MAX_FILES 240
+
+static struct fat12_dir_entry files[MAX_FILES];
+static char names[MAX_FILES][13];
+static unsigned file_count;
+static char paths[MAX_FILES][64];         // Files in subdirectories
+static unsigned path_count;
+static uint8_t *raw_data;                 // Second buffer to compare against
+static uint8_t *file_data;
+static uint32_t file_data_size;           // Whole clusters are read
+
+static void mount(int lazy) {
+    fat12_lazy = lazy;
+    if (fat12_init()) die("mount failed", 0);
+}
+
+static void name_of(const struct fat12_dir_entry *e, char *out) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < 8 && e->name[i] != ' '; i++) out[n++] = e->name[i];
+    if (e->ext[0] != ' ') {
+        out[n++] = '.';
+        for (unsigned i = 0; i < 3 && e->ext[i] != ' '; i++) out[n++] = e->ext[i];
+    }
+    out[n] = 0;
+}
+
+static void scan_files(void) {
+    unsigned slot = 0;
+    struct fat12_dir_entry *e;
+
+    while ((e = fat12_dir_next(0, &slot)) && file_count < MAX_FILES) {
+        if (e->attr & 0x10) continue;
+        files[file_count] = *e;
+        name_of(e, names[file_count]);
+        file_count++;
+    }
+}
+
+// Paths of the files below `dir`; subdirectories are visited once the
+// directory is done, as entries point into the shared sector buffer
+static void scan_paths(unsigned short dir, const char *prefix) {
+    unsigned short subdirs[16];
+    char subnames[16][13];
+    unsigned slot = 0, n = 0;
+    struct fat12_dir_entry *e;
+
+    while ((e = fat12_dir_next(dir, &slot))) {
+        char name[13];
+        name_of(e, name);
+        if (name[0] == '.') continue;
+        if (e->attr & 0x10) {
+            if (n < 16) {
+                subdirs[n] = e->start_cluster;
+                strcpy(subnames[n++], name);
+            }
+        } else if (dir && path_count < MAX_FILES) {
+            snprintf(paths[path_count++], sizeof(paths[0]), "%.48s/%.12s", prefix, name);
+        }
+    }
+    for (unsigned i = 0; i < n; i++) {
+        char sub[64];
+        snprintf(sub, sizeof(sub), "%.48s/%.12s", prefix, subnames[i]);
+        scan_paths(subdirs[i], sub);
+    }
+}
+
+struct bench {
+    const char *name;
+    uint64_t ops;
+    uint64_t ns;
+    struct disk_counters start;
+};
+
+static void bench_begin(struct bench *b, const char *name) {
+    b->name = name;
+    b->ops = 0;
+    b->start = disk;
+    b->ns = host_ns();
+}
+
+static void bench_end(struct bench *b) {
+    b->ns = host_ns() - b->ns;
+    printf("%s,%llu,%.1f,%llu,%llu,%llu,%llu\n", b->name,
+           (unsigned long long)b->ops,
+           b->ops ? (double)b->ns / b->ops : 0.0,
+           (unsigned long long)(disk.requests - b->start.requests),
+           (unsigned long long)(disk.sectors - b->start.sectors),
+           (unsigned long long)(disk.seeks - b->start.seeks),
+           (unsigned long long)(disk.sim_us - b->start.sim_us));
+}
+
+// Mount, then find every file once: index built on demand
+static void bench_lookup_cold(int lazy) {
+    struct bench b;
+
+    bench_begin(&b, lazy ? "lookup_cold_lazy" : "lookup_cold_eager");
+    mount(lazy);
+    for (unsigned i = 0; i < file_count; i++, b.ops++) {
+        if (!fat12_find_file(names[i])) die("lookup failed", names[i]);
+    }
+    bench_end(&b);
+}
+
+// Index complete and root directory resident
+static void bench_lookup_warm(unsigned iterations) {
+    struct bench b;
+
+    for (unsigned i = 0; i < file_count; i++) fat12_find_file(names[i]);
+    bench_begin(&b, "lookup_warm");
+    for (unsigned n = 0; n < iterations; n++) {
+        for (unsigned i = 0; i < file_count; i++, b.ops++) {
+            if (!fat12_find_file(names[i])) die("lookup failed", names[i]);
+        }
+    }
+    bench_end(&b);
+
+    bench_begin(&b, "lookup_miss");
+    for (unsigned n = 0; n < iterations; n++, b.ops++) {
+        if (fat12_find_file("NOSUCH.FIL")) die("found a missing file", 0);
+    }
+    bench_end(&b);
+}
+
+// Files in subdirectories by full path: first after a mount, when each
+// directory is read, then from the dentry cache with no disk access
+static void bench_lookup_path(unsigned iterations) {
+    struct bench b;
+
+    bench_begin(&b, "lookup_path_cold");
+    mount(1);
+    for (unsigned i = 0; i < path_count; i++) {
+        if (strncmp(paths[i], "/DOCS/", 6)) continue;
+        if (!fat12_find_file(paths[i])) die("lookup failed", paths[i]);
+        b.ops++;
+    }
+    if (!b.ops) return;
+    fat12_find_file("/DOCS/2024/NOSUCH.FIL");
+    bench_end(&b);
+
+    bench_begin(&b, "lookup_path_warm");
+    for (unsigned n = 0; n < iterations; n++) {
+        for (unsigned i = 0; i < path_count; i++) {
+            if (strncmp(paths[i], "/DOCS/", 6)) continue;
+            if (!fat12_find_file(paths[i])) die("lookup failed", paths[i]);
+            b.ops++;
+        }
+        if (fat12_find_file("/DOCS/2024/NOSUCH.FIL")) die("found a missing file", 0);
+    }
+    bench_end(&b);
+}
+
+// Follow every chain to its end; ops are clusters visited
+static void bench_chain_walk(unsigned iterations) {
+    struct bench b;
+
+    bench_begin(&b, "chain_walk");
+    for (unsigned n = 0; n < iterations; n++) {
+        for (unsigned i = 0; i < file_count; i++) {
+            unsigned short c = files[i].start_cluster;
+            while (c >= 2 && c < 0xFF0) {
+                c = fat12_get_next_cluster(c);
+                b.ops++;
+            }
+        }
+    }
+    bench_end(&b);
+}
+
+// Every file in one call; ops are files, cold pass first (extent maps
+// built), then warm passes
+static void bench_read_files(unsigned iterations) {
+    struct bench b;
+
+    for (int warm = 0; warm < 2; warm++) {
+        bench_begin(&b, warm ? "read_file_warm" : "read_file_cold");
+        for (unsigned n = 0; n < (warm ? iterations : 1); n++) {
+            for (unsigned i = 0; i < file_count; i++, b.ops++) {
+                if (fat12_read_file(&files[i], file_data, file_data_size) != (long)files[i].size) {
+                    die("read failed", names[i]);
+                }
+            }
+        }
+        bench_end(&b);
+    }
+}
+
+// The streaming reader, a chunk at a time
+static void bench_stream(unsigned iterations) {
+    struct bench b;
+    struct fat12_file f;
+
+    bench_begin(&b, "read_chunk");
+    for (unsigned n = 0; n < iterations; n++) {
+        for (unsigned i = 0; i < file_count; i++) {
+            unsigned start;
+            long got;
+
+            if (fat12_open(&files[i], &f)) die("open failed", names[i]);
+            while ((got = fat12_read_chunk(&f, stream_buf[1], STREAM_CHUNK_BYTES, &start)) > 0) {
+                b.ops++;
+            }
+            if (got < 0) die("read failed", names[i]);
+            fat12_close(&f);
+        }
+    }
+    bench_end(&b);
+}
+
+// Create a file, append to it a sector at a time, sync, then delete it and
+// sync again; ops are appends
+static void bench_append(unsigned iterations) {
+    struct bench b;
+    uint8_t sector[512];
+
+    memset(sector, 'w', sizeof(sector));
+    bench_begin(&b, "append_sync");
+    for (unsigned n = 0; n < iterations; n++) {
+        struct fat12_dir_entry *e = fat12_create("BENCH.OUT");
+        if (!e) die("create failed", "BENCH.OUT");
+        for (unsigned i = 0; i < 32; i++, b.ops++) {
+            if (fat12_append(e, sector, sizeof(sector)) != sizeof(sector)) die("append failed", 0);
+        }
+        if (fat12_sync() || fat12_delete("BENCH.OUT") || fat12_sync()) die("sync failed", 0);
+    }
+    bench_end(&b);
+}
+
+// The compressed copies under /LZ against the same files stored raw in the
+// root, each pass after a fresh mount; ops are files. Every copy is checked
+// against the original first.
+static void bench_read_lz(void) {
+    struct fat12_dir_entry packed[MAX_FILES], raw[MAX_FILES];
+    struct fat12_dir_entry *e;
+    unsigned n = 0;
+    struct bench b;
+
+    for (unsigned i = 0; i < path_count && n < MAX_FILES; i++) {
+        if (strncmp(paths[i], "/LZ/", 4)) continue;
+        if (!(e = fat12_find_file(paths[i]))) die("lookup failed", paths[i]);
+        packed[n] = *e;
+        if (!(e = fat12_find_file(paths[i] + 4))) die("no raw copy of", paths[i]);
+        raw[n] = *e;
+
+        long got = lz_read_file(&packed[n], file_data, file_data_size);
+        if (got != (long)raw[n].size || fat12_read_file(&raw[n], raw_data, file_data_size) != got ||
+            memcmp(file_data, raw_data, got)) {
+            die("decoded copy differs", paths[i]);
+        }
+        n++;
+    }
+    if (!n) return;
+
+    for (int lz = 0; lz < 2; lz++) {
+        mount(1);
+        bench_begin(&b, lz ? "read_lz" : "read_raw");
+        for (unsigned i = 0; i < n; i++, b.ops++) {
+            long got = lz ? lz_read_file(&packed[i], file_data, file_data_size)
+                          : fat12_read_file(&raw[i], file_data, file_data_size);
+            if (got != (long)raw[i].size) die("read failed", paths[i]);
+        }
+        bench_end(&b);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = 0;
+    unsigned iterations = 100;
+    int lazy = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) verbose = 1;
+        else if (!strcmp(argv[i], "-e")) lazy = 0;
+        else if (!path) path = argv[i];
+        else iterations = strtoul(argv[i], 0, 0);
+    }
+    if (!path) {
+        fprintf(stderr, "usage: fat12_bench [-v] [-e] IMAGE [ITERATIONS]\n");
+        return 1;
+    }
+
+    host_load_image(path);
+    mount(lazy);
+    scan_files();
+    scan_paths(0, "");
+    if (!file_count) die("no files on the image", path);
+
+    uint32_t largest = 0;
+    for (unsigned i = 0; i < file_count; i++) {
+        if (files[i].size > largest) largest = files[i].size;
+    }
+    file_data_size = largest + disk_geom.cluster_bytes;
+    file_data = malloc(file_data_size);
+    raw_data = malloc(file_data_size);
+    if (!file_data || !raw_data) die("out of memory", 0);
+
+    printf("bench,ops,host_ns_per_op,disk_requests,disk_sectors,seeks,sim_us\n");
+    bench_lookup_cold(1);
+    bench_lookup_cold(0);
+    mount(lazy);
+    bench_lookup_warm(iterations);
+    bench_lookup_path(iterations);
+    bench_chain_walk(iterations);
+    mount(lazy);
+    bench_read_files(iterations);
+    bench_stream(iterations);
+    bench_append(iterations);
+    bench_read_lz();
+    return 0;
+}
+
+#endif
@@ -0,0 +1,463 @@
+// fat12_test: checks for fat12.c on images made by mkfat12
+//
+// Usage: fat12_test FILES.IMG ROOT.IMG EMPTY.IMG
+//
+// FILES.IMG is the image from the fat12-test target: generated text files,
+// some split into runs, ONE.TXT of one cluster, EMPTY.TXT of none, GONE.TXT
+// and LFN.TXT for the test to turn into a deleted and a long-name entry,
+// LAST.TXT after them, and FULL, a one-cluster directory with no free slot.
+// ROOT.IMG has every root directory slot taken, EMPTY.IMG nothing at all.
+//
+// Each case starts from a fresh copy of its image and changes it in memory
+// directly; the FAT and directories are checked against a decoder of its
+// own reading the raw sectors. Prints the failures and exits non-zero if
+// any.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fat12.h"
+
+// tools/fat12_host.c
+uint8_t *host_load_image(const char *path);
+
+static const char *files_img, *root_img, *empty_img;
+static uint8_t *image;
+static unsigned checks, failures;
+
+static uint8_t fat[FAT12_MAX_FAT_SECTORS * 512];
+static uint8_t fat2[FAT12_MAX_FAT_SECTORS * 512];
+
+static void check(int ok, const char *what, const char *arg) {
+    checks++;
+    if (ok) return;
+    failures++;
+    fprintf(stderr, "fat12_test: %s%s%s\n", what, arg ? ": " : "", arg ? arg : "");
+}
+
+static void mount(const char *path, int lazy) {
+    if (path) image = host_load_image(path);
+    fat12_lazy = lazy;
+    if (fat12_init()) {
+        fprintf(stderr, "fat12_test: mount failed\n");
+        exit(1);
+    }
+}
+
+// Raw FAT access, independent of fat12.c
+
+static void image_write(unsigned lba, unsigned count, const void *buf) {
+    memcpy(image + lba * 512, buf, count * 512);
+}
+
+static void fat_load(uint8_t *buf, unsigned copy) {
+    unsigned lba = disk_geom.fat_lba + copy * boot_sector.sectors_per_fat;
+    if (disk_read_sectors(lba, boot_sector.sectors_per_fat, buf)) {
+        fprintf(stderr, "fat12_test: cannot read the FAT\n");
+        exit(1);
+    }
+}
+
+static void fat_store(const uint8_t *buf) {
+    for (unsigned k = 0; k < boot_sector.num_fats; k++) {
+        unsigned lba = disk_geom.fat_lba + k * boot_sector.sectors_per_fat;
+        image_write(lba, boot_sector.sectors_per_fat, buf);
+    }
+}
+
+static unsigned fat_get(const uint8_t *buf, unsigned cluster) {
+    const uint8_t *p = buf + cluster + cluster / 2;
+    return cluster & 1 ? (p[0] >> 4) | (p[1] << 4) : p[0] | ((p[1] & 0x0F) << 8);
+}
+
+static void fat_put(uint8_t *buf, unsigned cluster, unsigned value) {
+    uint8_t *p = buf + cluster + cluster / 2;
+    if (cluster & 1) {
+        p[0] = (p[0] & 0x0F) | ((value << 4) & 0xF0);
+        p[1] = value >> 4;
+    } else {
+        p[0] = value;
+        p[1] = (p[1] & 0xF0) | ((value >> 8) & 0x0F);
+    }
+}
+
+// Clusters in the chain from `first`, or 0 if it leaves the volume or loops
+static unsigned chain_length(const uint8_t *buf, unsigned first, unsigned *last) {
+    unsigned n = 0, c = first;
+
+    *last = 0;
+    while (c >= 2 && c < 0xFF8) {
+        if (c - 2 >= disk_geom.cluster_count || n > disk_geom.cluster_count) return 0;
+        *last = c;
+        c = fat_get(buf, c);
+        n++;
+    }
+    return n;
+}
+
+static unsigned clusters_for(uint32_t size) {
+    return (size + disk_geom.cluster_bytes - 1) / disk_geom.cluster_bytes;
+}
+
+// Raw root directory slot `slot`, read or written back
+static void root_slot(unsigned slot, uint8_t *entry, int write) {
+    uint8_t sector[512];
+    unsigned lba = disk_geom.root_lba + slot / 16;
+
+    disk_read_sectors(lba, 1, sector);
+    if (write) {
+        memcpy(sector + slot % 16 * 32, entry, 32);
+        image_write(lba, 1, sector);
+    } else {
+        memcpy(entry, sector + slot % 16 * 32, 32);
+    }
+}
+
+static int root_find_slot(const char *dos_name) {
+    uint8_t e[32];
+    for (unsigned i = 0; i < boot_sector.root_entries; i++) {
+        root_slot(i, e, 0);
+        if (!memcmp(e, dos_name, 11)) return i;
+    }
+    return -1;
+}
+
+// Turn the directory entry at `e` into a deleted or a long-name entry. The
+// long-name entry keeps the 8.3 name in its first 11 bytes, so only the
+// attribute tells them apart.
+static void mangle(uint8_t *e, int lfn) {
+    if (lfn) {
+        e[11] = 0x0F;
+        e[12] = 0;
+        e[26] = e[27] = 0;
+    } else {
+        e[0] = 0xE5;
+    }
+}
+
+static void name_of(const struct fat12_dir_entry *e, char *out) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < 8 && e->name[i] != ' '; i++) out[n++] = e->name[i];
+    if (e->ext[0] != ' ') {
+        out[n++] = '.';
+        for (unsigned i = 0; i < 3 && e->ext[i] != ' '; i++) out[n++] = e->ext[i];
+    }
+    out[n] = 0;
+}
+
+// mkfat12's generated text: "NAME offset\r\n" lines of 32 bytes
+static uint8_t *expected_text(const char *name, uint32_t size) {
+    uint8_t *buf = malloc(size + 33);
+    char line[40];
+
+    for (uint32_t off = 0; off < size; off += 32) {
+        snprintf(line, sizeof(line), "%-12s %017lu\r\n", name, (unsigned long)off);
+        memcpy(buf + off, line, 32);
+    }
+    return buf;
+}
+
+// Chain and contents of every file in the directory at `dir`; returns how
+// many files have more than one run
+static unsigned check_files(unsigned short dir, const char *prefix) {
+    struct fat12_dir_entry list[64];
+    unsigned count = 0, fragmented = 0, slot = 0;
+    struct fat12_dir_entry *e;
+
+    while ((e = fat12_dir_next(dir, &slot)) && count < 64) {
+        if (!(e->attr & 0x18)) list[count++] = *e;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        char name[13], path[32];
+        unsigned last;
+        struct fat12_file f;
+
+        name_of(&list[i], name);
+        snprintf(path, sizeof(path), "%s%s", prefix, name);
+
+        unsigned n = chain_length(fat, list[i].start_cluster, &last);
+        check(n == clusters_for(list[i].size), "chain length does not match the size", path);
+        if (n) {
+            check(fat12_get_next_cluster(last) >= 0xFF8, "chain does not end", path);
+            for (unsigned c = list[i].start_cluster; c != last; c = fat_get(fat, c)) {
+                if (fat_get(fat, c) != c + 1) {
+                    fragmented++;
+                    break;
+                }
+            }
+        }
+
+        uint8_t *want = expected_text(name, list[i].size);
+        uint8_t *got = malloc(list[i].size + disk_geom.cluster_bytes);
+        long len = fat12_read_file(&list[i], got, list[i].size + disk_geom.cluster_bytes);
+        check(len == (long)list[i].size && !memcmp(got, want, list[i].size),
+              "fat12_read_file contents differ", path);
+
+        // Again through the streaming reader, a chunk at a time
+        uint32_t pos = 0;
+        unsigned start;
+        long chunk = 0;
+        int same = !fat12_open(&list[i], &f);
+        while (same && (chunk = fat12_read_chunk(&f, stream_buf[1], STREAM_CHUNK_BYTES, &start)) > 0) {
+            same = pos + chunk <= list[i].size && !memcmp(stream_buf[1] + start, want + pos, chunk);
+            pos += chunk;
+        }
+        fat12_close(&f);
+        check(same && chunk == 0 && pos == list[i].size, "fat12_read_chunk contents differ", path);
+
+        free(want);
+        free(got);
+    }
+    return fragmented;
+}
+
+// Every 12-bit entry as fat12.c reads it against the raw decoding: odd
+// clusters take the high 12 bits of their word, even ones the low
+static void test_fat_entries(int lazy) {
+    unsigned odd = 0, even = 0, mismatch = 0;
+
+    mount(files_img, lazy);
+    fat_load(fat, 0);
+    fat_load(fat2, 1);
+    check(!memcmp(fat, fat2, boot_sector.sectors_per_fat * 512), "FAT copies differ", 0);
+
+    for (unsigned c = 2; c < disk_geom.cluster_count + 2u; c++) {
+        unsigned want = fat_get(fat, c);
+        if (fat12_get_next_cluster(c) != want) mismatch++;
+        if (want) {
+            if (c & 1) odd++;
+            else even++;
+        }
+    }
+    check(!mismatch, lazy ? "FAT entries differ (lazy mount)" : "FAT entries differ (eager mount)", 0);
+    check(odd && even, "image has no chains through both odd and even entries", 0);
+}
+
+static void test_files(int lazy) {
+    mount(files_img, lazy);
+    fat_load(fat, 0);
+    check(check_files(0, "") > 0, "image has no fragmented file", 0);
+
+    struct fat12_dir_entry *e = fat12_find_file("EMPTY.TXT");
+    check(e && e->size == 0 && e->start_cluster == 0, "EMPTY.TXT is not empty", 0);
+    e = fat12_find_file("ONE.TXT");
+    check(e && fat12_get_next_cluster(e->start_cluster) >= 0xFF8, "ONE.TXT is not one cluster", 0);
+
+    e = fat12_find_file("FULL");
+    check(e && (e->attr & 0x10), "no FULL directory", 0);
+    if (e) check_files(e->start_cluster, "FULL/");
+}
+
+// Every value from 0xFF8 to 0xFFF ends a chain, not just 0xFFF
+static void test_end_of_chain(void) {
+    struct fat12_dir_entry *e;
+    unsigned slot = 0, n = 0, last;
+
+    mount(files_img, 1);
+    fat_load(fat, 0);
+    while ((e = fat12_dir_next(0, &slot))) {
+        if (e->attr & 0x18 || !chain_length(fat, e->start_cluster, &last)) continue;
+        fat_put(fat, last, 0xFF8 + (n++ & 7));
+    }
+    fat_store(fat);
+    check(n >= 8, "too few files for every end-of-chain value", 0);
+
+    for (int lazy = 0; lazy < 2; lazy++) {
+        mount(0, lazy);
+        check_files(0, "");
+    }
+}
+
+// Deleted and long-name entries in the root and in a full subdirectory:
+// skipped by lookups and listings, without hiding the entries after them
+static void test_deleted_lfn(void) {
+    uint8_t e[32];
+    int gone, lfn;
+
+    mount(files_img, 1);
+    gone = root_find_slot("GONE    TXT");
+    lfn = root_find_slot("LFN     TXT");
+    check(gone >= 0 && lfn >= 0, "no GONE.TXT or LFN.TXT", 0);
+    if (gone < 0 || lfn < 0) return;
+
+    root_slot(gone, e, 0);
+    mangle(e, 0);
+    root_slot(gone, e, 1);
+    root_slot(lfn, e, 0);
+    mangle(e, 1);
+    root_slot(lfn, e, 1);
+
+    // FULL/F3.TXT deleted and FULL/F4.TXT a long-name entry
+    struct fat12_dir_entry *full = fat12_find_file("FULL");
+    if (!full) return;
+    unsigned lba = fat12_cluster_lba(full->start_cluster);
+    uint8_t sector[512];
+    disk_read_sectors(lba, 1, sector);
+    for (unsigned i = 0; i < 16; i++) {
+        if (!memcmp(sector + i * 32, "F3      TXT", 11)) mangle(sector + i * 32, 0);
+        if (!memcmp(sector + i * 32, "F4      TXT", 11)) mangle(sector + i * 32, 1);
+    }
+    image_write(lba, 1, sector);
+
+    for (int lazy = 0; lazy < 2; lazy++) {
+        mount(0, lazy);
+        check(!fat12_find_file("GONE.TXT"), "deleted entry found", "GONE.TXT");
+        check(!fat12_find_file("LFN.TXT"), "long-name entry found", "LFN.TXT");
+        check(fat12_find_file("LAST.TXT") != 0, "entry after them not found", "LAST.TXT");
+        check(!fat12_find_file("FULL/F3.TXT"), "deleted entry found", "FULL/F3.TXT");
+        check(!fat12_find_file("FULL/F4.TXT"), "long-name entry found", "FULL/F4.TXT");
+        check(fat12_find_file("FULL/F14.TXT") != 0, "last slot of a full directory not found",
+              "FULL/F14.TXT");
+        check(!fat12_find_file("FULL/NOSUCH.TXT"), "missing file found in a full directory", 0);
+        // Again, answered this time by the negative dentry the miss left
+        check(!fat12_find_file("FULL/NOSUCH.TXT"), "missing file found in a full directory", 0);
+
+        unsigned slot = 0;
+        struct fat12_dir_entry *d;
+        while ((d = fat12_dir_next(0, &slot))) {
+            check(d->attr != 0x0F && d->name[0] != 0xE5, "listing shows a dead entry", 0);
+        }
+    }
+
+    // A new file takes the first deleted slot
+    check(fat12_create("NEW.TXT") != 0, "create failed", "NEW.TXT");
+    check(!fat12_sync(), "sync failed", 0);
+    root_slot(gone, e, 0);
+    check(!memcmp(e, "NEW     TXT", 11), "deleted slot not reused", "NEW.TXT");
+}
+
+// The root directory filled by fat12_create, each file found right away,
+// and one more refused; then, after a remount, a slot freed and reused,
+// and the result read back
+static void test_full_root(int lazy) {
+    char name[13];
+    unsigned entries, found = 0, slot = 0;
+    uint8_t byte = 'x';
+
+    mount(empty_img, lazy);
+    entries = boot_sector.root_entries;
+    for (unsigned i = 0; i < entries; i++) {
+        snprintf(name, sizeof(name), "F%u.TXT", i);
+        struct fat12_dir_entry *e = fat12_create(name);
+        check(e != 0, "create failed", name);
+        if (e && (i == 0 || i == entries - 1)) {
+            check(fat12_append(e, &byte, 1) == 1, "append failed", name);
+        }
+
+        // Found at once, wherever the index had stopped scanning
+        check(fat12_find_file(name) == e, "created file not found", name);
+        check(!fat12_create(name), "created a second entry of the same name", name);
+    }
+    check(!fat12_create("OVER.TXT"), "create succeeded in a full directory", "OVER.TXT");
+    check(!fat12_sync(), "sync failed", 0);
+
+    mount(0, 1);
+    check(!fat12_delete("F100.TXT"), "delete failed", "F100.TXT");
+    check(fat12_create("OVER.TXT") != 0, "create failed after a delete", "OVER.TXT");
+    check(!fat12_create("OVER2.TXT"), "create succeeded in a full directory", "OVER2.TXT");
+    check(!fat12_sync(), "sync failed", 0);
+
+    mount(0, 1);
+    while (fat12_dir_next(0, &slot)) found++;
+    check(found == entries, "wrong number of entries after remount", 0);
+    for (unsigned i = 0; i < entries; i++) {
+        snprintf(name, sizeof(name), "F%u.TXT", i);
+        check((fat12_find_file(name) != 0) == (i != 100), "wrong lookup after remount", name);
+    }
+    check(fat12_find_file("OVER.TXT") != 0, "not found after remount", "OVER.TXT");
+    struct fat12_dir_entry *e = fat12_find_file("F223.TXT");
+    check(e && e->size == 1, "append lost after remount", "F223.TXT");
+}
+
+// A root directory filled by mkfat12: every entry found, the last slot
+// included, and a missing name not
+static void test_root_image(int lazy) {
+    char name[13];
+    unsigned entries, found = 0, slot = 0;
+
+    mount(root_img, lazy);
+    entries = boot_sector.root_entries;
+    while (fat12_dir_next(0, &slot)) found++;
+    check(found == entries, "wrong number of entries in a full root", 0);
+    for (unsigned i = 1; i <= entries; i++) {
+        snprintf(name, sizeof(name), "R%u.TXT", i);
+        check(fat12_find_file(name) != 0, "entry in a full root not found", name);
+    }
+    check(!fat12_find_file("NOSUCH.TXT"), "missing file found in a full root", 0);
+}
+
+// Appends write 12-bit entries for clusters of both parities without
+// touching their neighbours, in every FAT copy
+static void test_append_fat(void) {
+    static uint8_t before[FAT12_MAX_FAT_SECTORS * 512];
+    uint8_t data[5 * 512 + 100];
+    unsigned last;
+
+    mount(files_img, 1);
+    fat_load(before, 0);
+    for (unsigned i = 0; i < sizeof(data); i++) data[i] = i * 7;
+
+    struct fat12_dir_entry *e = fat12_create("APP.TXT");
+    check(e != 0, "create failed", "APP.TXT");
+    if (!e) return;
+    check(fat12_append(e, data, 1000) == 1000, "append failed", "APP.TXT");
+    check(fat12_append(e, data + 1000, sizeof(data) - 1000) == sizeof(data) - 1000,
+          "append failed", "APP.TXT");
+    check(!fat12_sync(), "sync failed", 0);
+
+    fat_load(fat, 0);
+    fat_load(fat2, 1);
+    check(!memcmp(fat, fat2, boot_sector.sectors_per_fat * 512), "FAT copies differ after sync", 0);
+
+    mount(0, 1);
+    e = fat12_find_file("APP.TXT");
+    check(e && e->size == sizeof(data), "size lost after remount", "APP.TXT");
+    if (!e) return;
+
+    unsigned n = chain_length(fat, e->start_cluster, &last);
+    check(n == clusters_for(sizeof(data)), "appended chain has the wrong length", "APP.TXT");
+
+    // Only the new chain's entries may have changed
+    unsigned changed = 0, odd = 0, even = 0;
+    for (unsigned c = 2; c < disk_geom.cluster_count + 2u; c++) {
+        if (fat_get(fat, c) == fat_get(before, c)) continue;
+        changed++;
+        if (c & 1) odd++;
+        else even++;
+        check(fat_get(before, c) == 0, "append changed a used FAT entry", 0);
+    }
+    check(changed == n, "append changed FAT entries outside its chain", 0);
+    check(odd && even, "appended chain does not cover both parities", 0);
+
+    uint8_t got[sizeof(data) + 512];
+    check(fat12_read_file(e, got, sizeof(got)) == sizeof(data) && !memcmp(got, data, sizeof(data)),
+          "appended contents differ", "APP.TXT");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: fat12_test FILES.IMG ROOT.IMG EMPTY.IMG\n");
+        return 1;
+    }
+    files_img = argv[1];
+    root_img = argv[2];
+    empty_img = argv[3];
+
+    test_fat_entries(1);
+    test_fat_entries(0);
+    test_files(1);
+    test_files(0);
+    test_end_of_chain();
+    test_deleted_lfn();
+    test_root_image(1);
+    test_root_image(0);
+    test_full_root(1);
+    test_full_root(0);
+    test_append_fat();
+
+    printf("fat12_test: %u checks, %u failed\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,201 @@
+// lzpack: compress a file into the format lz.c decodes on load
+//
+// Usage: lzpack [-w BITS] IN OUT
+//
+//   -w BITS   window of 2^BITS bytes, 8-16 (16). cat decodes through a ring
+//             of this size, so smaller windows need less memory to print.
+//
+// Greedy parsing over hash chains, with one step of lazy matching: a match
+// is put off by a byte when the next position has a longer one. Also built
+// into mkfat12 for its -z option (with -DLZPACK_NO_MAIN).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_MAGIC      0x5A4C         // "LZ", see lz.h
+#define LZ_HEADER     16
+#define LZ_MIN_MATCH  4
+
+#define HASH_BITS     15
+#define MAX_CHAIN     256            // Candidates tried per position
+#define NONE          0xFFFFFFFFu
+
+struct packer {
+    const uint8_t *src;
+    uint32_t size;
+    uint32_t window;                 // Largest offset
+    uint32_t *head;                  // Latest position per hash
+    uint32_t *prev;                  // Previous position with the same hash
+    uint8_t *out;
+    uint32_t len;
+};
+
+static uint32_t hash4(const uint8_t *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void insert(struct packer *pk, uint32_t pos) {
+    if (pos + LZ_MIN_MATCH > pk->size) return;
+    uint32_t h = hash4(pk->src + pos);
+    pk->prev[pos] = pk->head[h];
+    pk->head[h] = pos;
+}
+
+// Longest match for `pos` among earlier positions, nearest first
+static uint32_t find_match(const struct packer *pk, uint32_t pos, uint32_t *offset) {
+    uint32_t best = 0, limit = pk->size - pos;
+    unsigned chain = MAX_CHAIN;
+
+    if (limit < LZ_MIN_MATCH) return 0;
+    for (uint32_t c = pk->head[hash4(pk->src + pos)]; c != NONE && chain--; c = pk->prev[c]) {
+        if (pos - c > pk->window) break;
+        if (pk->src[c + best] != pk->src[pos + best]) continue;
+
+        uint32_t n = 0;
+        while (n < limit && pk->src[c + n] == pk->src[pos + n]) n++;
+        if (n > best) {
+            best = n;
+            *offset = pos - c;
+            if (n == limit) break;
+        }
+    }
+    return best >= LZ_MIN_MATCH ? best : 0;
+}
+
+static void put_length(struct packer *pk, uint32_t n) {
+    while (n >= 255) {
+        pk->out[pk->len++] = 255;
+        n -= 255;
+    }
+    pk->out[pk->len++] = n;
+}
+
+// Literals src[anchor..pos), then a match unless match_len is 0
+static void emit(struct packer *pk, uint32_t anchor, uint32_t pos, uint32_t offset,
+                 uint32_t match_len) {
+    uint32_t lit = pos - anchor;
+    uint32_t m = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    pk->out[pk->len++] = ((lit < 15 ? lit : 15) << 4) | (m < 15 ? m : 15);
+    if (lit >= 15) put_length(pk, lit - 15);
+    memcpy(pk->out + pk->len, pk->src + anchor, lit);
+    pk->len += lit;
+    if (!match_len) return;
+
+    pk->out[pk->len++] = offset & 0xFF;
+    pk->out[pk->len++] = offset >> 8;
+    if (m >= 15) put_length(pk, m - 15);
+}
+
+static void put16(uint8_t *p, unsigned v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+// Packed copy of `src`, header included, or 0 when out of memory
+uint8_t *lz_pack(const uint8_t *src, uint32_t size, unsigned window_bits, uint32_t *packed_size) {
+    struct packer pk;
+    uint32_t pos = 0, anchor = 0;
+
+    if (window_bits < 8) window_bits = 8;
+    if (window_bits > 16) window_bits = 16;
+    pk.src = src;
+    pk.size = size;
+    pk.window = (1u << window_bits) - 1;
+    pk.head = malloc(sizeof(uint32_t) << HASH_BITS);
+    pk.prev = malloc(sizeof(uint32_t) * (size ? size : 1));
+    pk.out = malloc(LZ_HEADER + size + size / 255 + 16);
+    pk.len = LZ_HEADER;
+    if (!pk.head || !pk.prev || !pk.out) {
+        free(pk.head);
+        free(pk.prev);
+        free(pk.out);
+        return 0;
+    }
+    memset(pk.head, 0xFF, sizeof(uint32_t) << HASH_BITS);
+
+    while (pos < size) {
+        uint32_t offset = 0, next_offset = 0;
+        uint32_t len = find_match(&pk, pos, &offset);
+
+        if (len && len < pk.size - pos) {
+            insert(&pk, pos);
+            if (find_match(&pk, pos + 1, &next_offset) > len + 1) {
+                pos++;
+                continue;
+            }
+        } else if (!len) {
+            insert(&pk, pos++);
+            continue;
+        } else {
+            insert(&pk, pos);
+        }
+
+        emit(&pk, anchor, pos, offset, len);
+        for (uint32_t i = 1; i < len; i++) insert(&pk, pos + i);
+        pos += len;
+        anchor = pos;
+    }
+    if (anchor < size) emit(&pk, anchor, size, 0, 0);
+
+    memset(pk.out, 0, LZ_HEADER);
+    put16(pk.out, LZ_MAGIC);
+    pk.out[2] = LZ_HEADER;
+    pk.out[3] = window_bits;
+    put32(pk.out + 4, size);
+    put32(pk.out + 8, pk.len - LZ_HEADER);
+
+    free(pk.head);
+    free(pk.prev);
+    *packed_size = pk.len;
+    return pk.out;
+}
+
+#ifndef LZPACK_NO_MAIN
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "lzpack: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    unsigned window_bits = 16;
+    int i = 1;
+
+    if (argc > 2 && !strcmp(argv[1], "-w")) {
+        window_bits = strtoul(argv[2], 0, 0);
+        i = 3;
+    }
+    if (argc - i != 2 || window_bits < 8 || window_bits > 16) {
+        fprintf(stderr, "usage: lzpack [-w BITS] IN OUT\n");
+        return 1;
+    }
+
+    FILE *f = fopen(argv[i], "rb");
+    if (!f) die("cannot open", argv[i]);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *src = malloc(size ? size : 1);
+    if (!src || fread(src, 1, size, f) != (size_t)size) die("cannot read", argv[i]);
+    fclose(f);
+
+    uint32_t packed;
+    uint8_t *out = lz_pack(src, size, window_bits, &packed);
+    if (!out) die("out of memory", 0);
+
+    f = fopen(argv[i + 1], "wb");
+    if (!f || fwrite(out, 1, packed, f) != packed || fclose(f)) die("cannot write", argv[i + 1]);
+    printf("%s: %ld -> %lu bytes\n", argv[i], size, (unsigned long)packed);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,386 @@
+// mkfat12: build a bootable BubblesOS floppy image with a FAT12 file system
+//
+// Usage: mkfat12 OUT.img boot.bin kernel.bin [file specs...]
+//
+//   -d PATH[:ENTRIES]     directory with room for ENTRIES entries (64)
+//   -t NAME:SIZE[:RUNS]   generated text file of SIZE bytes
+//   -a NAME:SIZE[:RUNS]   generated app ("BX" header, entry does RETF)
+//   -f NAME=PATH          copy of a host file
+//   -z                    compress the next file (tools/lzpack.c format)
+//
+// NAME may be a path such as APPS/GAME.BIN into a directory made earlier
+// with -d. Directories are allocated whole and never grow.
+//
+// The geometry comes from the BPB in boot.bin, and the kernel goes in the
+// reserved sectors after it. Either may be "-": a 1.44 MB boot sector with
+// just a BPB, or no kernel, for images that are only read by host tools.
+//
+// Clusters are handed out in ascending order; RUNS > 1 splits a file into
+// that many runs with a free cluster between them, so fragmentation is
+// reproducible. Runs on the host, no root or mtools needed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t *image;
+static uint32_t image_size;
+
+static unsigned bytes_per_sector, sectors_per_cluster, reserved, num_fats;
+static unsigned root_entries, total_sectors, sectors_per_fat;
+static unsigned fat_lba, root_lba, data_lba, cluster_count;
+
+static unsigned next_cluster = 2;
+static unsigned dir_used;
+
+#define MAX_DIRS 64
+
+struct dir {
+    char     path[64];
+    unsigned first;                  // First cluster, the rest follow it
+    unsigned entries;
+    unsigned used;
+};
+
+static struct dir dirs[MAX_DIRS];
+static unsigned dir_count;
+
+// tools/lzpack.c
+uint8_t *lz_pack(const uint8_t *src, uint32_t size, unsigned window_bits, uint32_t *packed_size);
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "mkfat12: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+static unsigned get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void put16(uint8_t *p, unsigned v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+static uint8_t *load(const char *path, uint32_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) die("cannot open", path);
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(n ? n : 1);
+    if (!buf || fread(buf, 1, n, f) != (size_t)n) die("cannot read", path);
+    fclose(f);
+    *size = n;
+    return buf;
+}
+
+static void fat_set(unsigned cluster, unsigned value) {
+    for (unsigned i = 0; i < num_fats; i++) {
+        uint8_t *fat = image + (fat_lba + i * sectors_per_fat) * bytes_per_sector;
+        uint8_t *p = fat + cluster + cluster / 2;
+        if (cluster & 1) {
+            p[0] = (p[0] & 0x0F) | ((value << 4) & 0xF0);
+            p[1] = (value >> 4) & 0xFF;
+        } else {
+            p[0] = value & 0xFF;
+            p[1] = (p[1] & 0xF0) | ((value >> 8) & 0x0F);
+        }
+    }
+}
+
+// 8.3 name, upper-cased and space padded
+static void dos_name(const char *name, uint8_t out[11]) {
+    const char *dot = strchr(name, '.');
+    size_t base = dot ? (size_t)(dot - name) : strlen(name);
+
+    if (base == 0 || base > 8 || (dot && strlen(dot + 1) > 3)) die("bad 8.3 name", name);
+    memset(out, ' ', 11);
+    for (size_t i = 0; i < base; i++) {
+        out[i] = (name[i] >= 'a' && name[i] <= 'z') ? name[i] - 32 : name[i];
+    }
+    if (dot) {
+        for (size_t i = 0; dot[1 + i]; i++) {
+            char c = dot[1 + i];
+            out[8 + i] = (c >= 'a' && c <= 'z') ? c - 32 : c;
+        }
+    }
+}
+
+static uint8_t *cluster_data(unsigned c) {
+    return image + (data_lba + (c - 2) * sectors_per_cluster) * bytes_per_sector;
+}
+
+static struct dir *find_dir(const char *path, size_t len) {
+    for (unsigned i = 0; i < dir_count; i++) {
+        if (strlen(dirs[i].path) == len && !strncmp(dirs[i].path, path, len)) return &dirs[i];
+    }
+    return 0;
+}
+
+// Next free entry for `path`, in the root or in its parent directory;
+// *base is set to the last component of the path
+static uint8_t *new_entry(const char *path, const char **base, unsigned *parent) {
+    const char *slash = strrchr(path, '/');
+
+    if (!slash) {
+        if (dir_used == root_entries) die("root directory full", path);
+        *base = path;
+        *parent = 0;
+        return image + root_lba * bytes_per_sector + dir_used++ * 32;
+    }
+
+    struct dir *d = find_dir(path, slash - path);
+    if (!d) die("no such directory (make it with -d first)", path);
+    if (d->used == d->entries) die("directory full", path);
+    *base = slash + 1;
+    *parent = d->first;
+    return cluster_data(d->first) + d->used++ * 32;
+}
+
+static void put_entry(uint8_t *e, const uint8_t name[11], uint8_t attr, unsigned first,
+                      uint32_t size) {
+    memset(e, 0, 32);
+    memcpy(e, name, 11);
+    e[11] = attr;
+    put16(e + 22, 0x6000);                        // 12:00:00
+    put16(e + 24, ((2025 - 1980) << 9) | (9 << 5) | 26);
+    put16(e + 26, first);
+    put32(e + 28, size);
+}
+
+// Directory of `entries` entries in consecutive clusters, with its "."
+// and ".." entries
+static void add_dir(const char *path, unsigned entries) {
+    unsigned cluster_bytes = sectors_per_cluster * bytes_per_sector;
+    const char *base;
+    unsigned parent;
+    uint8_t name[11];
+
+    if (dir_count == MAX_DIRS || strlen(path) >= sizeof(dirs[0].path)) die("too many directories", path);
+    if (entries < 2) entries = 2;
+    entries = (entries * 32 + cluster_bytes - 1) / cluster_bytes * cluster_bytes / 32;
+
+    uint8_t *e = new_entry(path, &base, &parent);
+    dos_name(base, name);
+    unsigned first = next_cluster;
+    for (unsigned i = 0; i < entries * 32 / cluster_bytes; i++) {
+        unsigned c = next_cluster++;
+        if (c - 2 >= cluster_count) die("image full", path);
+        fat_set(c, i + 1 < entries * 32 / cluster_bytes ? c + 1 : 0xFFF);
+    }
+    put_entry(e, name, 0x10, first, 0);
+
+    struct dir *d = &dirs[dir_count++];
+    strcpy(d->path, path);
+    d->first = first;
+    d->entries = entries;
+    d->used = 2;
+
+    memset(name, ' ', 11);
+    name[0] = '.';
+    put_entry(cluster_data(first), name, 0x10, first, 0);
+    name[1] = '.';
+    put_entry(cluster_data(first) + 32, name, 0x10, parent, 0);
+}
+
+static void add_file(const char *path, const uint8_t *data, uint32_t size, unsigned runs) {
+    unsigned cluster_bytes = sectors_per_cluster * bytes_per_sector;
+    unsigned clusters = (size + cluster_bytes - 1) / cluster_bytes;
+    unsigned per_run, first = 0, prev = 0;
+    const char *name;
+    unsigned parent;
+    uint8_t dos[11];
+
+    uint8_t *e = new_entry(path, &name, &parent);
+    dos_name(name, dos);
+    if (runs < 1) runs = 1;
+    if (runs > clusters) runs = clusters ? clusters : 1;
+    per_run = clusters ? (clusters + runs - 1) / runs : 0;
+
+    for (unsigned i = 0; i < clusters; i++) {
+        if (i && i % per_run == 0) next_cluster++;   // Leave a hole between runs
+        unsigned c = next_cluster++;
+        if (c - 2 >= cluster_count) die("image full", name);
+
+        uint32_t off = i * cluster_bytes;
+        uint32_t n = size - off < cluster_bytes ? size - off : cluster_bytes;
+        memcpy(cluster_data(c), data + off, n);
+
+        if (prev) fat_set(prev, c);
+        else first = c;
+        prev = c;
+    }
+    if (prev) fat_set(prev, 0xFFF);
+    put_entry(e, dos, 0x20, first, size);         // Archive
+}
+
+// Lines of "NAME offset\n", 32 bytes each, so any slice is recognizable
+static uint8_t *gen_text(const char *name, uint32_t size) {
+    uint8_t *buf = malloc(size + 33);
+    const char *slash = strrchr(name, '/');
+    char line[40];
+
+    if (slash) name = slash + 1;
+
+    if (!buf) die("out of memory", name);
+    for (uint32_t off = 0; off < size; off += 32) {
+        snprintf(line, sizeof(line), "%-12s %017lu\r\n", name, (unsigned long)off);
+        memcpy(buf + off, line, 32);
+    }
+    return buf;
+}
+
+// Minimal executable: header paragraph, then code whose entry is RETF
+static uint8_t *gen_app(const char *name, uint32_t size) {
+    if (size <= 16 || size - 16 > 0xFFFF) die("app size must be 17..65551", name);
+
+    uint8_t *buf = calloc(1, size);
+    if (!buf) die("out of memory", name);
+    put16(buf + 0, 0x5842);                       // "BX"
+    put16(buf + 2, 1);                            // Header paragraphs
+    put16(buf + 4, size - 16);                    // Code
+    put16(buf + 6, 0);                            // Data
+    put16(buf + 8, 0);                            // BSS
+    put16(buf + 10, 0);                           // Entry
+    put16(buf + 12, 256);                         // Stack
+    put16(buf + 14, 0);                           // Relocations
+    buf[16] = 0xCB;                               // RETF
+    return buf;
+}
+
+// 1.44 MB BPB as in boot.asm, reserving room for `kernel_size` bytes
+static uint8_t *default_boot(uint32_t kernel_size) {
+    uint8_t *boot = calloc(1, 512);
+    if (!boot) die("out of memory", 0);
+
+    boot[0] = 0xEB;                               // JMP SHORT $, NOP
+    boot[1] = 0xFE;
+    boot[2] = 0x90;
+    memcpy(boot + 3, "BUBBLES ", 8);
+    put16(boot + 11, 512);                        // Bytes per sector
+    boot[13] = 1;                                 // Sectors per cluster
+    put16(boot + 14, 1 + (kernel_size + 511) / 512);
+    boot[16] = 2;                                 // FATs
+    put16(boot + 17, 224);                        // Root entries
+    put16(boot + 19, 2880);                       // Sectors
+    boot[21] = 0xF0;                              // Media
+    put16(boot + 22, 9);                          // Sectors per FAT
+    put16(boot + 24, 18);                         // Sectors per track
+    put16(boot + 26, 2);                          // Heads
+    boot[510] = 0x55;
+    boot[511] = 0xAA;
+    return boot;
+}
+
+// NAME:SIZE[:RUNS]
+static void parse_gen(char *spec, char **name, uint32_t *size, unsigned *runs) {
+    char *colon = strchr(spec, ':');
+    if (!colon) die("expected NAME:SIZE[:RUNS]", spec);
+    *colon = 0;
+    *name = spec;
+    *size = strtoul(colon + 1, &colon, 0);
+    *runs = *colon == ':' ? strtoul(colon + 1, 0, 0) : 1;
+}
+
+int main(int argc, char **argv) {
+    uint32_t boot_size, kernel_size;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: mkfat12 OUT.img boot.bin kernel.bin [-d PATH[:ENTRIES]] "
+                        "[-z] [-t NAME:SIZE[:RUNS]] [-a NAME:SIZE[:RUNS]] [-f NAME=PATH]...\n");
+        return 1;
+    }
+
+    uint8_t *kernel = strcmp(argv[3], "-") ? load(argv[3], &kernel_size) : calloc(1, kernel_size = 1);
+    if (!strcmp(argv[3], "-")) kernel_size = 0;
+    uint8_t *boot = strcmp(argv[2], "-") ? load(argv[2], &boot_size) : default_boot(kernel_size);
+    if (!strcmp(argv[2], "-")) boot_size = 512;
+    if (boot_size != 512 || boot[510] != 0x55 || boot[511] != 0xAA) die("not a boot sector", argv[2]);
+
+    bytes_per_sector = get16(boot + 11);
+    sectors_per_cluster = boot[13];
+    reserved = get16(boot + 14);
+    num_fats = boot[16];
+    root_entries = get16(boot + 17);
+    total_sectors = get16(boot + 19);
+    sectors_per_fat = get16(boot + 22);
+    if (bytes_per_sector != 512 || !sectors_per_cluster || !num_fats || !total_sectors) {
+        die("boot sector has no usable BPB", argv[2]);
+    }
+    if (kernel_size > (reserved - 1) * 512) die("kernel does not fit the reserved sectors", argv[3]);
+
+    fat_lba = reserved;
+    root_lba = fat_lba + num_fats * sectors_per_fat;
+    data_lba = root_lba + (root_entries * 32 + 511) / 512;
+    cluster_count = (total_sectors - data_lba) / sectors_per_cluster;
+
+    image_size = total_sectors * 512;
+    image = calloc(1, image_size);
+    if (!image) die("out of memory", 0);
+
+    memcpy(image, boot, 512);
+    memcpy(image + 512, kernel, kernel_size);
+    fat_set(0, 0xF00 | boot[21]);                 // Media descriptor
+    fat_set(1, 0xFFF);
+
+    int pack = 0;
+    for (int i = 4; i < argc; i++) {
+        char *name;
+        uint32_t size;
+        unsigned runs;
+        uint8_t *data;
+
+        if (!strcmp(argv[i], "-z")) {
+            pack = 1;
+            continue;
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            char *path = argv[++i];
+            char *colon = strchr(path, ':');
+            unsigned entries = 64;
+            if (colon) {
+                *colon = 0;
+                entries = strtoul(colon + 1, 0, 0);
+            }
+            add_dir(path, entries);
+            continue;
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            parse_gen(argv[++i], &name, &size, &runs);
+            data = gen_text(name, size);
+        } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+            parse_gen(argv[++i], &name, &size, &runs);
+            data = gen_app(name, size);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            name = argv[++i];
+            char *eq = strchr(name, '=');
+            if (!eq) die("expected NAME=PATH", name);
+            *eq = 0;
+            data = load(eq + 1, &size);
+            runs = 1;
+        } else {
+            die("unknown option", argv[i]);
+        }
+
+        if (pack) {
+            uint8_t *packed = lz_pack(data, size, 16, &size);
+            if (!packed) die("out of memory", name);
+            free(data);
+            data = packed;
+            pack = 0;
+        }
+        add_file(name, data, size, runs);
+        free(data);
+    }
+
+    FILE *out = fopen(argv[1], "wb");
+    if (!out || fwrite(image, 1, image_size, out) != image_size || fclose(out)) {
+        die("cannot write", argv[1]);
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Flat profile from the kernel's 'prof dump' output.
+
+Reads the CSV the profiler sends on COM1 (any other lines, such as the rest
+of a serial transcript, are skipped), attributes each kernel bucket to the
+symbol it starts in, using the symbols of build/kernel.elf, and prints the
+samples per symbol, busiest first. Samples outside the kernel segment are
+listed by segment.
+
+Usage: prof.py [--elf FILE] [--nm BIN] DUMP
+"""
+
+import argparse
+import bisect
+import re
+import subprocess
+import sys
+
+LINE = re.compile(r"^([pbsoe]),(\d+),(\d+)\r?$")
+
+
+def read_dump(path):
+    interval, samples = 0, 0
+    buckets, segments, other = [], [], 0
+    with open(path, "rb") as f:
+        for raw in f:
+            m = LINE.match(raw.decode("ascii", "replace").strip())
+            if not m:
+                continue
+            tag, a, b = m.group(1), int(m.group(2)), int(m.group(3))
+            if tag == "p":
+                interval, samples = a, b
+                buckets, segments, other = [], [], 0
+            elif tag == "b":
+                buckets.append((a, b))
+            elif tag == "s":
+                segments.append((a, b))
+            elif tag == "o":
+                other = b
+    return interval, samples, buckets, segments, other
+
+
+def read_symbols(nm, elf):
+    out = subprocess.run([nm, "-n", elf], check=True, stdout=subprocess.PIPE,
+                         universal_newlines=True).stdout
+    syms = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tTrRdDbB":
+            syms.append((int(parts[0], 16), parts[2]))
+    return syms
+
+
+def segment_name(seg):
+    if seg >= 0xF000:
+        return "BIOS"
+    if seg >= 0xC000:
+        return "ROM"
+    return "segment %04X" % seg
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump")
+    parser.add_argument("--elf", default="build/kernel.elf")
+    parser.add_argument("--nm", default="ia16-elf-nm")
+    args = parser.parse_args()
+
+    interval, samples, buckets, segments, other = read_dump(args.dump)
+    if not samples:
+        sys.exit("prof: no samples in %s" % args.dump)
+    syms = read_symbols(args.nm, args.elf)
+    addrs = [a for a, _ in syms]
+
+    counts = {}
+    for offset, n in buckets:
+        i = bisect.bisect_right(addrs, offset) - 1
+        name = syms[i][1] if i >= 0 else "?"
+        counts[name] = counts.get(name, 0) + n
+    for seg, n in segments:
+        name = "[%s]" % segment_name(seg)
+        counts[name] = counts.get(name, 0) + n
+    if other:
+        counts["[other segments]"] = other
+
+    print("%d samples, one every %d ms" % (samples, interval))
+    print("%8s %6s  %s" % ("samples", "%", "symbol"))
+    for name, n in sorted(counts.items(), key=lambda kv: (-kv[1], kv[0])):
+        print("%8d %6.2f  %s" % (n, 100.0 * n / samples, name))
+
+
+if __name__ == "__main__":
+    main()
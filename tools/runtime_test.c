@@ -0,0 +1,138 @@
+// runtime_test: the 32-bit arithmetic from runtime.h, checked and timed on
+// the host
+//
+// Usage: runtime_test [SAMPLES]
+//
+// Every 16-bit divisor is checked against the C operators with edge-case
+// dividends and SAMPLES (16) pseudo-random ones; udiv32 also gets wide
+// divisors and u32_to_dec is compared with printf. Then the PIT divisor
+// computation (1193180 / d for every d) is timed with udiv32_16 and with
+// the repeated-subtraction div32_16 it replaced, one CSV row each. Exits
+// non-zero on the first mismatch.
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../runtime.h"
+
+#define PIT_FREQ 1193180UL
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t rnd(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint64_t host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void fail(const char *what, uint32_t n, uint32_t d, uint32_t got, uint32_t want) {
+    fprintf(stderr, "runtime_test: %s(%" PRIu32 ", %" PRIu32 ") = %" PRIu32 ", want %" PRIu32 "\n",
+            what, n, d, got, want);
+    exit(1);
+}
+
+// The kernel's routine before the 32-bit runtime: one subtraction per unit
+// of the quotient. `volatile` keeps the compiler from turning it back into
+// a divide.
+static uint16_t div32_16(uint32_t n, uint16_t d) {
+    volatile uint16_t q = 0;
+    while (n >= d) {
+        n -= d;
+        q++;
+    }
+    return q;
+}
+
+static void check_16(uint32_t n, uint16_t d) {
+    uint16_t r16;
+    uint32_t r32;
+    uint32_t q = udiv32_16(n, d, &r16);
+
+    if (q != n / d) fail("udiv32_16", n, d, q, n / d);
+    if (r16 != n % d) fail("udiv32_16 rem", n, d, r16, n % d);
+    if (umod32_16(n, d) != n % d) fail("umod32_16", n, d, umod32_16(n, d), n % d);
+    q = udiv32(n, d, &r32);
+    if (q != n / d || r32 != n % d) fail("udiv32", n, d, q, n / d);
+}
+
+static void check_32(uint32_t n, uint32_t d) {
+    uint32_t r;
+    uint32_t q = udiv32(n, d, &r);
+
+    if (q != n / d) fail("udiv32", n, d, q, n / d);
+    if (r != n % d) fail("udiv32 rem", n, d, r, n % d);
+}
+
+static void check_dec(uint32_t val) {
+    char got[11], want[11];
+    int n = u32_to_dec(val, got);
+
+    snprintf(want, sizeof(want), "%" PRIu32, val);
+    if (strcmp(got, want) || n != (int)strlen(want)) {
+        fprintf(stderr, "runtime_test: u32_to_dec(%" PRIu32 ") = \"%s\"\n", val, got);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned samples = argc > 1 ? strtoul(argv[1], 0, 0) : 16;
+    static const uint32_t edges[] = {
+        0, 1, 9, 10, 0xFFFF, 0x10000, 0x10001, PIT_FREQ, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF,
+    };
+    uint64_t checks = 0;
+
+    for (uint32_t d = 1; d <= 0xFFFF; d++) {
+        for (unsigned i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) check_16(edges[i], d);
+        check_16(d - 1, d);
+        check_16(d, d);
+        check_16((uint32_t)d << 16, d);
+        check_16(((uint32_t)d << 16) - 1, d);
+        for (unsigned i = 0; i < samples; i++) check_16(rnd(), d);
+        checks += sizeof(edges) / sizeof(edges[0]) + 4 + samples;
+    }
+
+    for (unsigned i = 0; i < 0x10000 * samples; i++) {
+        uint32_t d = rnd() | 0x10000;
+        check_32(rnd(), d);
+        check_32(0xFFFFFFFF, d);
+        check_32(d - 1, d);
+        check_32(d, d);
+        checks += 4;
+    }
+
+    for (unsigned i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) check_dec(edges[i]);
+    for (uint32_t p = 1; p && p <= 1000000000; p *= 10) {
+        check_dec(p - 1);
+        check_dec(p);
+    }
+    for (unsigned i = 0; i < 0x10000; i++) check_dec(rnd());
+    fprintf(stderr, "runtime_test: %" PRIu64 " divisions checked\n", checks);
+
+    // PIT divisors as speaker_on computes them, for every frequency the
+    // old routine could take (d >= 19 keeps its quotient within 16 bits)
+    uint64_t sum = 0, t0 = host_ns();
+    for (uint32_t d = 19; d <= 0xFFFF; d++) sum += udiv32_16(PIT_FREQ, d, 0);
+    uint64_t t1 = host_ns();
+    for (uint32_t d = 19; d <= 0xFFFF; d++) sum -= div32_16(PIT_FREQ, d);
+    uint64_t t2 = host_ns();
+    if (sum) {
+        fprintf(stderr, "runtime_test: div32_16 and udiv32_16 disagree\n");
+        return 1;
+    }
+
+    printf("routine,divisors,ns_per_divide\n");
+    printf("udiv32_16,%u,%.1f\n", 0xFFFF - 18, (double)(t1 - t0) / (0xFFFF - 18));
+    printf("div32_16,%u,%.1f\n", 0xFFFF - 18, (double)(t2 - t1) / (0xFFFF - 18));
+    return 0;
+}
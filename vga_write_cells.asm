@@ -0,0 +1,49 @@
+; vga_write_cells for 16-bit NASM
+; Function signature:
+; void vga_write_cells(farptr_t dst, const char *src, unsigned short len,
+;                      unsigned char attr)
+;
+; Stores `len` characters from the near buffer `src` into text-mode video
+; memory at `dst`, pairing each with the attribute byte `attr`.
+
+BITS 16
+
+section .text
+global vga_write_cells
+
+vga_write_cells:
+    push bp
+    mov  bp, sp
+    push cx
+    push si
+    push di
+    push es
+
+    ; Stack layout (16-bit):
+    ; [bp+0]  = old BP
+    ; [bp+2]  = return address
+    ; [bp+4]  = destination offset (word)
+    ; [bp+6]  = destination segment (word)
+    ; [bp+8]  = source pointer (word, DS-relative)
+    ; [bp+10] = length in characters (word)
+    ; [bp+12] = attribute (byte)
+
+    mov  di, [bp+4]
+    mov  es, [bp+6]
+    mov  si, [bp+8]
+    mov  cx, [bp+10]
+    mov  ah, [bp+12]
+    cld
+    jcxz .done
+.next:
+    lodsb
+    stosw
+    loop .next
+
+.done:
+    pop  es
+    pop  di
+    pop  si
+    pop  cx
+    pop  bp
+    ret